@@ -0,0 +1,753 @@
+// rainbench: in-process microbenchmarks for the Rain hash functions
+// Times the one-shot rainbow<> / rainstorm<> templates (Rainstorm at each
+// round count) and the HashState streaming path over input sizes from 1 B up
+// to 1 GiB, with warmup, CPU pinning and repeated samples. Short inputs also
+// get a latency run, where each hash is seeded with the previous result so
+// the calls cannot overlap.
+// Before any timing, every hashing path is checked to make no heap
+// allocations once warmed up; rainbench exits with status 2 if one does.
+// That covers rainsum's per-file path too (digest.h), run on temporary files.
+// Per-call costs are in core cycles where perf_event_open(2) can count them,
+// and in timer ticks otherwise (the TSC, which runs at the nominal rate and
+// not the core clock, or nanoseconds); the header line says which.
+// The "kernel" rows call the per-ISA builds rainsum uses (kernels.h), so
+// RAIN_ISA=scalar and RAIN_ISA=avx2 runs can be compared.
+// --scaling times tree hashing instead, on WorkPools of 1 up to N workers
+// pinned to the first CPUs of --cpu-list (all the CPUs we may use by
+// default), and reports the speedup and parallel efficiency at each count.
+//
+//   make rainbench && rain/bin/rainbench [--quick] [--max-size BYTES] [--samples N] [--cpu N] [--csv]
+//                                        [--scaling [--cpu-list LIST]]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#endif
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define RAIN_HAVE_TSC 1
+#endif
+
+// digest.h first: it brings in rainbow.cpp and rainstorm.cpp, which tree.h
+// needs ahead of it for the per-algorithm tree entry points
+#include "digest.h"
+#include "kernels.h"
+#include "multibuffer.h"
+#include "tree.h"
+
+// Every heap allocation in the process is counted, for the allocation check.
+// With glibc that is malloc and its relatives, so aligned_alloc and stdio
+// buffers count as well as operator new; elsewhere only operator new.
+static volatile uint64_t allocations = 0;
+
+#ifdef __GLIBC__
+extern "C" {
+  void* __libc_malloc(size_t size);
+  void* __libc_calloc(size_t n, size_t size);
+  void* __libc_realloc(void* p, size_t size);
+  void* __libc_memalign(size_t alignment, size_t size);
+  void __libc_free(void* p);
+
+  void* malloc(size_t size) noexcept {
+    allocations = allocations + 1;
+    return __libc_malloc(size);
+  }
+
+  void* calloc(size_t n, size_t size) noexcept {
+    allocations = allocations + 1;
+    return __libc_calloc(n, size);
+  }
+
+  void* realloc(void* p, size_t size) noexcept {
+    allocations = allocations + 1;
+    return __libc_realloc(p, size);
+  }
+
+  void* aligned_alloc(size_t alignment, size_t size) noexcept {
+    allocations = allocations + 1;
+    return __libc_memalign(alignment, size);
+  }
+
+  void* memalign(size_t alignment, size_t size) noexcept {
+    allocations = allocations + 1;
+    return __libc_memalign(alignment, size);
+  }
+
+  int posix_memalign(void** out, size_t alignment, size_t size) noexcept {
+    allocations = allocations + 1;
+    *out = __libc_memalign(alignment, size);
+    return *out ? 0 : ENOMEM;
+  }
+
+  void free(void* p) noexcept {
+    __libc_free(p);
+  }
+}
+#else
+void* operator new(size_t size) {
+  allocations = allocations + 1;
+  if (void* p = std::malloc(size ? size : 1)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+  std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  std::free(p);
+}
+#endif
+
+namespace {
+  typedef void (*hash_fn)(const void* in, const size_t len, const seed_t seed, void* out);
+
+  struct Target {
+    const char* name;
+    hash_fn hash;
+  };
+
+  // Feed a HashState in CHUNK_SIZE updates, the way rainsum streams files
+  template <typename State>
+  void streamed(const void* in, const size_t len, const seed_t seed, void* out) {
+    const uint8_t* data = static_cast<const uint8_t*>(in);
+    State state = State::initialize(seed, len);
+    for (size_t done = 0; done < len; done += CHUNK_SIZE) {
+      state.update(data + done, std::min(CHUNK_SIZE, len - done));
+    }
+    state.finalize(out);
+  }
+
+  // The seed-bound hashers, with the key schedule done once outside the calls
+  template <typename Keyed>
+  void keyedHash(const void* in, const size_t len, const seed_t seed, void* out) {
+    static const Keyed keyed(0x5eed);
+    (void)seed;
+    keyed.hash(in, len, out);
+  }
+
+  template <typename Keyed>
+  void keyedStream(const void* in, const size_t len, const seed_t seed, void* out) {
+    static const Keyed keyed(0x5eed);
+    const uint8_t* data = static_cast<const uint8_t*>(in);
+    (void)seed;
+    auto state = keyed.stream(len);
+    for (size_t done = 0; done < len; done += CHUNK_SIZE) {
+      state.update(data + done, std::min(CHUNK_SIZE, len - done));
+    }
+    state.finalize(out);
+  }
+
+  // Only checked for allocations, they time the same as the targets above
+  const Target keyed_targets[] = {
+    {"rainbow Keyed<256>",          keyedHash<rainbow::Keyed<256, bswap>>},
+    {"rainbow Keyed<256> stream",   keyedStream<rainbow::Keyed<256, bswap>>},
+    {"rainstorm Keyed<512>",        keyedHash<rainstorm::Keyed<512, bswap>>},
+    {"rainstorm Keyed<512> stream", keyedStream<rainstorm::Keyed<512, bswap>>},
+  };
+
+  // Through the table for the active ISA, on each call as rainsum does
+  void kernelRainbow(const void* in, const size_t len, const seed_t seed, void* out) {
+    rainisa::activeKernels().rainbow[2](in, len, seed, out);
+  }
+
+  void kernelRainstorm(const void* in, const size_t len, const seed_t seed, void* out) {
+    rainisa::activeKernels().rainstorm[rainisa::roundIndex(rainstorm::ROUNDS)][3](in, len, seed, out);
+  }
+
+  const Target targets[] = {
+    {"rainbow<64>",            rainbow::rainbow<64, bswap>},
+    {"rainbow<256>",           rainbow::rainbow<256, bswap>},
+    {"rainbow HashState<256>", streamed<rainbow::HashState<256>>},
+    {"rainstorm<64>",          rainstorm::rainstorm<64, bswap>},
+    {"rainstorm<512>",         rainstorm::rainstorm<512, bswap>},
+    {"rainstorm HashState<512>", streamed<rainstorm::HashState<512>>},
+    {"rainstorm<512> 2 rounds", rainstorm::rainstorm<512, bswap, 2>},
+    {"rainstorm<512> 6 rounds", rainstorm::rainstorm<512, bswap, 6>},
+    {"rainstorm<512> 8 rounds", rainstorm::rainstorm<512, bswap, 8>},
+    {"rainbow<256> kernel",     kernelRainbow},
+    {"rainstorm<512> kernel",   kernelRainstorm},
+  };
+
+  typedef void (*tree_fn)(const void* in, const size_t len, const seed_t seed, void* out, WorkPool* pool);
+
+  struct TreeTarget {
+    const char* name;
+    tree_fn hash;
+  };
+
+  const TreeTarget tree_targets[] = {
+    {"rainbow<256> tree",   rainbow::rainbow_tree<256, bswap>},
+    {"rainstorm<512> tree", rainstorm::rainstorm_tree<512, bswap>},
+  };
+
+  // Tree input for --scaling: 32 leaf groups, so up to 32 workers all get one
+  constexpr uint64_t SCALING_SIZE = uint64_t(256) << 20;
+
+  struct Options {
+    uint64_t max_size = uint64_t(1) << 30;
+    int samples = 15;
+    int cpu = -1;
+    bool csv = false;
+    bool scaling = false;
+    std::vector<unsigned> cpus;       // --cpu-list, for --scaling
+  };
+
+  // Raw timer ticks: the TSC where there is one, nanoseconds otherwise
+  inline uint64_t ticks() {
+#ifdef RAIN_HAVE_TSC
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+  }
+
+  // Core clock cycles spent by this thread, from the CPU's cycle counter.
+  // Not every machine has one to offer: without a PMU (many VMs), under a
+  // strict perf_event_paranoid or off Linux, available() is false.
+  class CycleCounter {
+    public:
+      CycleCounter() {
+#ifdef __linux__
+        struct perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+        // some hypervisors accept the event and never count
+        if (fd >= 0 && read() == 0) {
+          close(fd);
+          fd = -1;
+        }
+#endif
+      }
+
+      ~CycleCounter() {
+        if (fd >= 0) {
+          close(fd);
+        }
+      }
+
+      CycleCounter(const CycleCounter&) = delete;
+      CycleCounter& operator=(const CycleCounter&) = delete;
+
+      bool available() const {
+        return fd >= 0;
+      }
+
+      uint64_t read() const {
+        uint64_t count = 0;
+        if (fd < 0 || ::read(fd, &count, sizeof(count)) != sizeof(count)) {
+          return 0;
+        }
+        return count;
+      }
+
+    private:
+      int fd = -1;
+  };
+
+  // Ticks per second, measured against the steady clock
+  double tickRate() {
+#ifdef RAIN_HAVE_TSC
+    auto start = std::chrono::steady_clock::now();
+    uint64_t t0 = ticks();
+    while (std::chrono::steady_clock::now() - start < std::chrono::milliseconds(100)) {
+    }
+    uint64_t t1 = ticks();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return (t1 - t0) / elapsed.count();
+#else
+    return 1e9;
+#endif
+  }
+
+  bool pin(int cpu) {
+#ifdef __linux__
+    if (cpu < 0) {
+      cpu = sched_getcpu();
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+    (void)cpu;
+    return false;
+#endif
+  }
+
+  struct Stats {
+    double median;
+    double min;
+    double mad;           // median absolute deviation, relative to the median
+  };
+
+  Stats summarize(std::vector<double> values) {
+    std::sort(values.begin(), values.end());
+    Stats stats;
+    stats.median = values[values.size() / 2];
+    stats.min = values.front();
+    for (auto& value : values) {
+      value = std::fabs(value - stats.median);
+    }
+    std::sort(values.begin(), values.end());
+    stats.mad = stats.median > 0 ? values[values.size() / 2] / stats.median : 0;
+    return stats;
+  }
+
+  volatile uint64_t sink;
+
+  // Per-call cost of each sample, in timer ticks and, when counter is
+  // available, core cycles
+  struct Samples {
+    std::vector<double> ticks;
+    std::vector<double> cycles;
+  };
+
+  // One value per sample. Each sample runs enough calls to take about a
+  // millisecond, after one warmup sample.
+  Samples throughput(const Target& target, const uint8_t* data, size_t len, const Options& opts, double rate, const CycleCounter& counter) {
+    uint8_t out[64];
+    uint64_t calls = 1;
+    while (true) {
+      uint64_t t0 = ticks();
+      for (uint64_t i = 0; i < calls; i++) {
+        target.hash(data, len, i, out);
+      }
+      if ((ticks() - t0) / rate > 1e-3 || calls >= (uint64_t(1) << 30)) {
+        break;
+      }
+      calls *= 2;
+    }
+
+    Samples samples;
+    for (int s = 0; s < opts.samples; s++) {
+      uint64_t c0 = counter.read();
+      uint64_t t0 = ticks();
+      for (uint64_t i = 0; i < calls; i++) {
+        target.hash(data, len, i, out);
+      }
+      uint64_t t1 = ticks();
+      uint64_t c1 = counter.read();
+      samples.ticks.push_back(double(t1 - t0) / calls);
+      samples.cycles.push_back(double(c1 - c0) / calls);
+      sink = out[0];
+    }
+    return samples;
+  }
+
+  // Cost per call when every call waits on the one before it
+  Samples latency(const Target& target, const uint8_t* data, size_t len, const Options& opts, const CycleCounter& counter) {
+    const uint64_t calls = 1 << 16;
+    uint64_t out[8] = {0};
+    Samples samples;
+    for (int s = 0; s <= opts.samples; s++) {
+      uint64_t c0 = counter.read();
+      uint64_t t0 = ticks();
+      for (uint64_t i = 0; i < calls; i++) {
+        target.hash(data, len, out[0], out);
+      }
+      uint64_t t1 = ticks();
+      uint64_t c1 = counter.read();
+      // the first sample is the warmup
+      if (s > 0) {
+        samples.ticks.push_back(double(t1 - t0) / calls);
+        samples.cycles.push_back(double(c1 - c0) / calls);
+      }
+    }
+    sink = out[0];
+    return samples;
+  }
+
+  // An istream over memory, standing in for stdin
+  struct MemoryStream : std::streambuf {
+    MemoryStream(const uint8_t* data, size_t len) {
+      char* begin = reinterpret_cast<char*>(const_cast<uint8_t*>(data));
+      setg(begin, begin, begin + len);
+    }
+  };
+
+  void reportAllocations(const char* name, uint64_t made, bool csv) {
+    if (csv) {
+      std::printf("allocations,%s,,,,,,%llu,,,,,\n", name, (unsigned long long)made);
+    } else {
+      std::printf("%-28s %s\n", name, made ? (std::to_string(made) + " allocations").c_str() : "none");
+    }
+  }
+
+#ifndef _WIN32
+  // rainsum's per-file path (digest.h) on temporary files: small files mapped
+  // and read whole, a 3 MiB file mapped and streamed through PipelinedReader,
+  // stdin-sized input from a stream, and a batch group of small Rainstorm
+  // files in the multi-buffer lanes. Each is run once to warm up the thread's
+  // HashArena, then three more times under the counter. Returns the number of
+  // paths that allocated.
+  //
+  // Left out because they still allocate per file: streamed tree digests
+  // (leaf buffers and chaining values), stdin past STDIN_BUFFER_LIMIT
+  // (spooled to a temporary file), the reader thread where io_uring is not
+  // available (a std::thread per file), and hashBatch's bookkeeping around
+  // each digest (paths, output lines, per-group results and pool tasks).
+  int fileAllocationCheck(const uint8_t* data, uint64_t max_size, bool csv) {
+    constexpr size_t LARGE_FILE = 3 << 20;
+    const char* tmp = std::getenv("TMPDIR");
+    std::string dir = std::string(tmp && *tmp ? tmp : "/tmp") + "/rainbench.XXXXXX";
+    if (max_size < LARGE_FILE || !mkdtemp(&dir[0])) {
+      return 0;
+    }
+    std::vector<std::string> paths;
+    auto writeFile = [&](size_t len) {
+      paths.push_back(dir + "/" + std::to_string(paths.size()));
+      FILE* file = std::fopen(paths.back().c_str(), "wb");
+      bool written = file && std::fwrite(data, 1, len, file) == len;
+      if (file) {
+        std::fclose(file);
+      }
+      return written;
+    };
+    const size_t small_sizes[] = {0, 100, 4096, SMALL_FILE_READ};
+    bool written = true;
+    for (size_t len : small_sizes) {
+      written = writeFile(len) && written;
+    }
+    written = writeFile(LARGE_FILE) && written;
+    std::vector<BatchEntry> group(BATCH_GROUP);
+    for (size_t i = 0; i < BATCH_GROUP; i++) {
+      written = writeFile(1000 + 977 * i) && written;
+      group[i].path = paths.back();
+    }
+    const std::string& large = paths[std::size(small_sizes)];
+
+    int failed = 0;
+    if (written) {
+      HashOptions bow;
+      HashOptions storm;
+      storm.algot = HashAlgorithm::Rainstorm;
+      storm.size = 512;
+      Digest digest(64);
+      std::vector<Digest> digests;
+      std::vector<std::string> errors;
+      bool ring = PipelinedReader(large, false).usesRing();
+
+      auto check = [&](const char* name, auto digestOnce) {
+        digestOnce();
+        uint64_t before = allocations;
+        for (int i = 0; i < 3; i++) {
+          digestOnce();
+        }
+        uint64_t made = allocations - before;
+        reportAllocations(name, made, csv);
+        failed += made != 0;
+      };
+      for (HashOptions* opts : {&bow, &storm}) {
+        bool is_bow = opts == &bow;
+        digest.resize(opts->size / 8);
+        check(is_bow ? "rainbow small files mapped" : "rainstorm small files mapped", [&] {
+          opts->use_mmap = true;
+          for (size_t i = 0; i < std::size(small_sizes); i++) {
+            digestFile(*opts, paths[i], digest);
+          }
+        });
+        check(is_bow ? "rainbow small files read" : "rainstorm small files read", [&] {
+          opts->use_mmap = false;
+          for (size_t i = 0; i < std::size(small_sizes); i++) {
+            digestFile(*opts, paths[i], digest);
+          }
+        });
+        check(is_bow ? "rainbow 3 MiB file mapped" : "rainstorm 3 MiB file mapped", [&] {
+          opts->use_mmap = true;
+          digestFile(*opts, large, digest);
+        });
+        if (ring) {
+          check(is_bow ? "rainbow 3 MiB file read" : "rainstorm 3 MiB file read", [&] {
+            opts->use_mmap = false;
+            digestFile(*opts, large, digest);
+          });
+        }
+        check(is_bow ? "rainbow stdin 256 KiB" : "rainstorm stdin 256 KiB", [&] {
+          MemoryStream buffer(data, 256 << 10);
+          std::istream in(&buffer);
+          digestUnsized(*opts, in, digest);
+        });
+      }
+      check("rainstorm batch group", [&] {
+        storm.use_mmap = true;
+        digestGroup(storm, group, digests, errors);
+      });
+      if (!ring && !csv) {
+        std::printf("%-28s %s\n", "3 MiB file read", "not checked, no io_uring");
+      }
+    } else {
+      std::fprintf(stderr, "rainbench: cannot write the allocation check files in %s\n", dir.c_str());
+    }
+    for (const auto& path : paths) {
+      std::remove(path.c_str());
+    }
+    rmdir(dir.c_str());
+    return failed;
+  }
+#endif
+
+  // Heap allocations made by one call at each size, after a warmup call that
+  // may set up statics. Returns the number of paths that allocated.
+  int allocationCheck(const uint8_t* data, uint64_t max_size, bool csv) {
+    uint8_t out[64];
+    int failed = 0;
+    auto check = [&](const Target& target) {
+      uint64_t made = 0;
+      for (uint64_t size : {0, 1, 15, 16, 63, 64, 4096, 1 << 20, 3 << 20}) {
+        if (size > max_size) {
+          continue;
+        }
+        target.hash(data, size, 1, out);
+        uint64_t before = allocations;
+        target.hash(data, size, 2, out);
+        made += allocations - before;
+      }
+      reportAllocations(target.name, made, csv);
+      failed += made != 0;
+    };
+    if (!csv) {
+      std::printf("\nHeap allocations per call, after warmup\n");
+    }
+    for (const auto& target : targets) {
+      check(target);
+    }
+    for (const auto& target : keyed_targets) {
+      check(target);
+    }
+#ifndef _WIN32
+    failed += fileAllocationCheck(data, max_size, csv);
+#endif
+    return failed;
+  }
+
+  // The cycles_per_hash and cycles_per_byte CSV fields, empty without a counter
+  std::string cycleColumns(const CycleCounter& counter, const Stats& cost, uint64_t size) {
+    if (!counter.available()) {
+      return ",";
+    }
+    char fields[64];
+    std::snprintf(fields, sizeof(fields), "%.2f,%.4f", cost.median, cost.median / size);
+    return fields;
+  }
+
+  std::string sizeName(uint64_t size) {
+    const char* units[] = {"B", "KiB", "MiB", "GiB"};
+    int unit = 0;
+    while (size >= 1024 && size % 1024 == 0 && unit < 3) {
+      size /= 1024;
+      unit++;
+    }
+    return std::to_string(size) + " " + units[unit];
+  }
+
+  // Ticks per tree hash of len bytes on pool, one value per sample after a warmup
+  std::vector<double> treeSamples(const TreeTarget& target, const uint8_t* data, size_t len, WorkPool& pool, const Options& opts) {
+    uint8_t out[64];
+    std::vector<double> samples;
+    for (int s = 0; s <= opts.samples; s++) {
+      uint64_t t0 = ticks();
+      target.hash(data, len, s, out, &pool);
+      if (s > 0) {
+        samples.push_back(double(ticks() - t0));
+      }
+    }
+    sink = out[0];
+    return samples;
+  }
+
+  // Worker counts for the scaling curve: powers of two, then every CPU
+  std::vector<unsigned> workerCounts(unsigned cpus) {
+    std::vector<unsigned> counts;
+    for (unsigned n = 1; n < cpus; n *= 2) {
+      counts.push_back(n);
+    }
+    counts.push_back(cpus);
+    return counts;
+  }
+
+  void scaling(const uint8_t* data, uint64_t len, const Options& opts, double rate) {
+    if (!opts.csv) {
+      std::printf("\nTree scaling (%s input, worker i pinned to the i-th of %zu CPUs)\n%-26s %8s %12s %10s %10s %10s %8s\n",
+                  sizeName(len).c_str(), opts.cpus.size(), "function", "workers", "ms/hash", "GiB/s", "speedup", "efficiency", "MAD");
+    }
+    for (const auto& target : tree_targets) {
+      double single = 0;
+      for (unsigned workers : workerCounts(static_cast<unsigned>(opts.cpus.size()))) {
+        WorkPool pool(workers, std::vector<unsigned>(opts.cpus.begin(), opts.cpus.begin() + workers));
+        Stats stats = summarize(treeSamples(target, data, len, pool, opts));
+        double gibs = len / (stats.median / rate) / double(1 << 30);
+        if (workers == 1) {
+          single = gibs;
+        }
+        double speedup = gibs / single;
+        if (opts.csv) {
+          std::printf("scaling,%s,%llu,%.2f,%.4f,%.3f,%.2f,%.4f,%u,%.3f,%.3f,,\n", target.name, (unsigned long long)len, stats.median, stats.median / len, gibs,
+                      stats.median / rate * 1e9, stats.mad, workers, speedup, speedup / workers);
+        } else {
+          std::printf("%-26s %8u %12.2f %10.3f %9.2fx %9.0f%% %7.1f%%\n", target.name, workers, stats.median / rate * 1e3, gibs, speedup,
+                      speedup / workers * 100, stats.mad * 100);
+        }
+      }
+    }
+  }
+
+  void printUsage() {
+    std::printf("Usage: rainbench [--quick] [--max-size BYTES] [--samples N] [--cpu N] [--csv] [--scaling [--cpu-list LIST]]\n"
+                "  --quick            Stop the sweep at 16 MiB\n"
+                "  --max-size BYTES   Largest input to time. Default: 1 GiB\n"
+                "  --samples N        Timed samples per measurement. Default: 15\n"
+                "  --cpu N            Pin to CPU N. Default: the CPU we start on\n"
+                "  --csv              Print comma-separated values instead of tables\n"
+                "  --scaling          Time tree hashing on 1 to N workers instead of the size sweep\n"
+                "  --cpu-list LIST    CPUs for the --scaling workers, like 0-7,16-23. Default: all we may use\n");
+  }
+}
+
+int main(int argc, char** argv) {
+  Options opts;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--quick") {
+      opts.max_size = 16 << 20;
+    } else if (arg == "--max-size" && i + 1 < argc) {
+      opts.max_size = std::strtoull(argv[++i], nullptr, 10);
+    } else if (arg == "--samples" && i + 1 < argc) {
+      opts.samples = std::max(1, std::atoi(argv[++i]));
+    } else if (arg == "--cpu" && i + 1 < argc) {
+      opts.cpu = std::atoi(argv[++i]);
+    } else if (arg == "--csv") {
+      opts.csv = true;
+    } else if (arg == "--scaling") {
+      opts.scaling = true;
+    } else if (arg == "--cpu-list" && i + 1 < argc) {
+      try {
+        opts.cpus = rainnuma::parseCpuList(argv[++i]);
+      } catch (const std::runtime_error& e) {
+        std::fprintf(stderr, "rainbench: %s\n", e.what());
+        return 1;
+      }
+    } else {
+      printUsage();
+      return arg == "-h" || arg == "--help" ? 0 : 1;
+    }
+  }
+
+  // before pin() narrows our affinity to one CPU
+  if (opts.cpus.empty()) {
+    opts.cpus = rainnuma::allowedCpus();
+    if (opts.cpus.empty()) {
+      opts.cpus.push_back(0);
+    }
+  }
+  rainisa::active();
+  if (!rainisa::environmentProblem().empty()) {
+    std::fprintf(stderr, "rainbench: RAIN_ISA: %s\n", rainisa::environmentProblem().c_str());
+  }
+  bool pinned = pin(opts.cpu);
+  double rate = tickRate();
+  CycleCounter counter;
+  // the per-call columns: core cycles when we can count them, else timer ticks
+  const char* unit = counter.available() ? "cycles" : "ticks";
+#ifdef RAIN_HAVE_TSC
+  const char* timer = "TSC, which runs at the nominal rate and not the core clock";
+#else
+  const char* timer = "steady clock, in nanoseconds";
+#endif
+
+  std::vector<uint8_t> data(opts.scaling ? std::max(opts.max_size, SCALING_SIZE) : opts.max_size);
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = static_cast<uint8_t>(i * 131 + 7);
+  }
+
+  if (opts.csv) {
+    std::printf("kind,function,bytes,ticks_per_hash,ticks_per_byte,gib_per_s,ns_per_hash,mad,workers,speedup,efficiency,cycles_per_hash,cycles_per_byte\n");
+  } else {
+    std::printf("rainbench: %s, %s kernels, %d samples per point (median, min and MAD shown)\n",
+                pinned ? "pinned" : "not pinned", rainisa::name(rainisa::active()), opts.samples);
+    if (counter.available()) {
+      std::printf("Costs per call in core cycles, times from the %.2f GHz %s\n", rate / 1e9, timer);
+    } else {
+      std::printf("No core cycle counter here: costs per call are in ticks of the %.2f GHz %s\n", rate / 1e9, timer);
+    }
+  }
+
+  if (allocationCheck(data.data(), opts.max_size, opts.csv)) {
+    std::fprintf(stderr, "rainbench: a hashing path allocated on the heap\n");
+    return 2;
+  }
+
+  if (opts.scaling) {
+    scaling(data.data(), SCALING_SIZE, opts, rate);
+    return 0;
+  }
+
+  // Latency for short keys
+  if (!opts.csv) {
+    std::printf("\nLatency (dependent calls)\n%-26s %10s %12s %12s %8s\n", "function", "bytes", (std::string(unit) + "/hash").c_str(), "ns/hash", "MAD");
+  }
+  for (const auto& target : targets) {
+    for (uint64_t size : {8, 16, 32, 64}) {
+      if (size > opts.max_size) {
+        continue;
+      }
+      Samples samples = latency(target, data.data(), size, opts, counter);
+      Stats stats = summarize(samples.ticks);
+      Stats cost = counter.available() ? summarize(samples.cycles) : stats;
+      double ns = stats.median / rate * 1e9;
+      if (opts.csv) {
+        std::printf("latency,%s,%llu,%.2f,%.4f,,%.2f,%.4f,,,,%s\n", target.name, (unsigned long long)size, stats.median, stats.median / size, ns, stats.mad,
+                    cycleColumns(counter, cost, size).c_str());
+      } else {
+        std::printf("%-26s %10llu %12.1f %12.2f %7.1f%%\n", target.name, (unsigned long long)size, cost.median, ns, stats.mad * 100);
+      }
+    }
+  }
+
+  // Throughput sweep, sizes 1 B, 4 B, 16 B, ... up to max_size
+  if (!opts.csv) {
+    std::printf("\nThroughput (independent calls)\n%-26s %10s %12s %12s %10s %10s %8s\n", "function", "size", (std::string(unit) + "/hash").c_str(),
+                (std::string(unit) + "/byte").c_str(), "GiB/s", "best GiB/s", "MAD");
+  }
+  for (const auto& target : targets) {
+    for (uint64_t size = 1; size <= opts.max_size; size *= 4) {
+      Samples samples = throughput(target, data.data(), size, opts, rate, counter);
+      Stats stats = summarize(samples.ticks);
+      Stats cost = counter.available() ? summarize(samples.cycles) : stats;
+      double gibs = size / (stats.median / rate) / double(1 << 30);
+      double best = size / (stats.min / rate) / double(1 << 30);
+      if (opts.csv) {
+        std::printf("throughput,%s,%llu,%.2f,%.4f,%.3f,%.2f,%.4f,,,,%s\n", target.name, (unsigned long long)size, stats.median, stats.median / size, gibs,
+                    stats.median / rate * 1e9, stats.mad, cycleColumns(counter, cost, size).c_str());
+      } else {
+        std::printf("%-26s %10s %12.1f %12.3f %10.3f %10.3f %7.1f%%\n", target.name, sizeName(size).c_str(), cost.median, cost.median / size, gibs, best, stats.mad * 100);
+      }
+    }
+  }
+  return 0;
+}
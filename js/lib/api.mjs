@@ -167,16 +167,183 @@ export async function rainbowHash(hashSize, seed, input) {
   return hashHex;
 }
 
+// Hash a stream of byte chunks with constant memory
+// source is a ReadableStream or any (async) iterable of Uint8Arrays, and
+// totalLength its length in bytes, which the hash needs up front (File.size,
+// Content-Length, fs.stat). Chunks are copied through the stream's fixed WASM
+// input buffer, so nothing the size of the input is ever allocated.
+export async function rainstormHashStream(hashSize, seed, source, totalLength) {
+  return hashStream('rainstorm', hashSize, seed, source, totalLength);
+}
+
+export async function rainbowHashStream(hashSize, seed, source, totalLength) {
+  return hashStream('rainbow', hashSize, seed, source, totalLength);
+}
+
+async function hashStream(algorithm, hashSize, seed, source, totalLength) {
+  if ( ! rain.loaded ) {
+    await loadRain();
+  }
+  const {_malloc, _free} = rain;
+  const init = rain[`_${algorithm}StreamInit`];
+  const bufferOf = rain[`_${algorithm}StreamBuffer`];
+  const update = rain[`_${algorithm}StreamUpdate`];
+  const final = rain[`_${algorithm}StreamFinal`];
+  const bufferSize = rain[`_${algorithm}StreamBufferSize`]();
+
+  const stream = init(hashSize, BigInt(seed), BigInt(totalLength));
+  if ( ! stream ) {
+    throw new Error(`Unsupported hash size for ${algorithm}: ${hashSize}`);
+  }
+
+  const hashLength = hashSize/8;
+  const hashPtr = _malloc(hashLength);
+  let fed = 0;
+  try {
+    for await (const chunk of chunksOf(source)) {
+      const bytes = chunk instanceof Uint8Array ? chunk : new Uint8Array(chunk);
+      for( let offset = 0; offset < bytes.length; offset += bufferSize ) {
+        const piece = bytes.subarray(offset, offset + bufferSize);
+        // look the buffer up every time: memory growth can move the heap
+        rain.HEAPU8.set(piece, bufferOf(stream));
+        update(stream, piece.length);
+      }
+      fed += bytes.length;
+    }
+  } catch(e) {
+    final(stream, hashPtr);
+    _free(hashPtr);
+    throw e;
+  }
+  final(stream, hashPtr);
+
+  const hash = rain.HEAPU8.subarray(hashPtr, hashPtr + hashLength);
+  const hashHex = Array.from(new Uint8Array(hash)).map(x => x.toString(16).padStart(2, '0')).join('');
+  _free(hashPtr);
+
+  if ( BigInt(fed) !== BigInt(totalLength) ) {
+    throw new Error(`Stream was ${fed} bytes but totalLength is ${totalLength}`);
+  }
+  return hashHex;
+}
+
+async function* chunksOf(source) {
+  if ( source?.getReader && ! source[Symbol.asyncIterator] ) {
+    const reader = source.getReader();
+    try {
+      while(true) {
+        const {done, value} = await reader.read();
+        if ( done ) break;
+        yield value;
+      }
+    } finally {
+      reader.releaseLock();
+    }
+    return;
+  }
+  yield* source;
+}
+
+// Tree-mode digests, the same as `rainsum --tree`. Large inputs are cut into
+// 1 MiB leaves, which the SIMD module hashes eight at a time and the threaded
+// module spreads over its workers. In browsers, call this from a Worker when
+// the threaded module is loaded, since it blocks while the leaves are hashed.
+export async function rainstormTreeHash(hashSize, seed, input) {
+  return treeHash('rainstorm', hashSize, seed, input);
+}
+
+export async function rainbowTreeHash(hashSize, seed, input) {
+  return treeHash('rainbow', hashSize, seed, input);
+}
+
+async function treeHash(algorithm, hashSize, seed, input) {
+  if ( ! rain.loaded ) {
+    await loadRain();
+  }
+  const {stringToUTF8, lengthBytesUTF8, _malloc, _free} = rain;
+  const hashLength = hashSize/8;
+  const hashPtr = _malloc(hashLength);
+
+  let inputPtr;
+  let inputLength;
+  if ( typeof input == "string" ) {
+    inputLength = lengthBytesUTF8(input);
+    inputPtr = _malloc(inputLength + 1);
+    stringToUTF8(input, inputPtr, inputLength + 1);
+  } else {
+    inputLength = input.length;
+    inputPtr = _malloc(inputLength);
+    rain.HEAPU8.set(input, inputPtr);
+  }
+
+  const status = rain[`_${algorithm}TreeHash`](hashSize, inputPtr, inputLength, BigInt(seed), hashPtr);
+  const hash = rain.HEAPU8.subarray(hashPtr, hashPtr + hashLength);
+  const hashHex = Array.from(new Uint8Array(hash)).map(x => x.toString(16).padStart(2, '0')).join('');
+  _free(hashPtr);
+  _free(inputPtr);
+
+  if ( status !== 0 ) {
+    throw new Error(`Unsupported hash size for ${algorithm}: ${hashSize}`);
+  }
+  return hashHex;
+}
+
+// Which module was loaded: 'threads', 'simd' or 'scalar'
+export async function rainVariant() {
+  if ( ! rain.loaded ) {
+    await loadRain();
+  }
+  return rain.variant;
+}
+
+// Smallest module using a SIMD128 instruction, as in wasm-feature-detect
+const SIMD_PROBE = new Uint8Array([0,97,115,109,1,0,0,0,1,5,1,96,0,1,123,3,2,1,0,10,10,1,8,0,65,0,253,15,253,98,11]);
+
+function supportedVariants() {
+  const variants = [];
+  const simd = typeof WebAssembly == "object" && WebAssembly.validate(SIMD_PROBE);
+  // browsers only hand out SharedArrayBuffer to cross-origin isolated pages
+  const threads = typeof SharedArrayBuffer == "function" && (typeof crossOriginIsolated == "undefined" || crossOriginIsolated);
+  if ( simd && threads ) {
+    variants.push(['threads', './../../wasm/rain-threads.js']);
+  }
+  if ( simd ) {
+    variants.push(['simd', './../../wasm/rain-simd.js']);
+  }
+  variants.push(['scalar', './../../wasm/rain.js']);
+  return variants;
+}
+
+// Load the fastest module the runtime supports, falling back when one is missing
 async function loadRain() {
-  let resolve;
-  const pr = new Promise(res => resolve = res);
-  import('./../../wasm/rain.js').then(async x => {
-    await untilTrue(() => !!x?.default?.asm);
-    rain = x.default;
-    rain.loaded = true;
-    resolve();
-  });
-  return pr;
+  let lastError;
+  for( const [variant, path] of supportedVariants() ) {
+    try {
+      await loadModule(variant, path);
+      return;
+    } catch(e) {
+      lastError = e;
+    }
+  }
+  throw lastError;
+}
+
+// Load one module by name, 'threads', 'simd' or 'scalar', instead of the
+// automatic choice, for benchmarks and A/B runs. Call it before hashing.
+export async function loadRainVariant(variant) {
+  const found = supportedVariants().find(([name]) => name === variant);
+  if ( ! found ) {
+    throw new Error(`This runtime cannot run the ${variant} module`);
+  }
+  await loadModule(...found);
+}
+
+async function loadModule(variant, path) {
+  const x = await import(path);
+  await untilTrue(() => !!x?.default?.asm);
+  rain = x.default;
+  rain.variant = variant;
+  rain.loaded = true;
 }
 
 async function untilTrue(pred, MAX = 1000, MS_BETWEEN = 50) {
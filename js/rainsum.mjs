@@ -3,7 +3,7 @@ import fs from 'fs';
 import process from 'process';
 import yargs from 'yargs';
 import { hideBin } from 'yargs/helpers';
-import { rainbowHash, rainstormHash } from './lib/api.mjs';
+import { rainbowHash, rainstormHash, rainbowHashStream, rainstormHashStream } from './lib/api.mjs';
 
 const testVectors = [
     "",
@@ -59,6 +59,15 @@ async function hashBuffer(mode, algorithm, seed, buffer, outputStream, hashSize,
 async function hashAnything(mode, algorithm, seed, inputPath, outputPath, size) {
     let buffer = [];
     let inputName;
+    if (inputPath !== '/dev/stdin' && fs.statSync(inputPath).isFile()) {
+        // Files are streamed through the WASM module, so memory stays flat
+        const hashStream = algorithm.endsWith('storm') ? rainstormHashStream : rainbowHashStream;
+        const totalLength = fs.statSync(inputPath).size;
+        const hash = await hashStream(size, seed, fs.createReadStream(inputPath), totalLength);
+        const outputStream = fs.createWriteStream(outputPath, { flags: 'a' });
+        outputStream.write(`${hash} ${inputPath}\n`);
+        return;
+    }
     if (inputPath === '/dev/stdin') {
         for await (const chunk of process.stdin) {
             buffer.push(chunk);
@@ -0,0 +1,111 @@
+// librain: the C ABI declared in rain.h, built on the header-only templates
+//
+//   make librain   # rain/bin/librain.a and rain/bin/librain.so
+
+#define RAIN_BUILDING_LIBRARY
+#include "rain.h"
+#include "rain.hpp"
+
+#include <new>
+
+static_assert(RAIN_ABI_VERSION != 1 || sizeof(RainState) == 280, "RainState is 280 bytes for RAIN_ABI_VERSION 1, bump the version to change it");
+
+namespace {
+  template <typename State>
+  State* stateOf(RainState* state) {
+    static_assert(sizeof(State) <= sizeof(state->opaque), "RainState is too small for this HashState");
+    static_assert(alignof(State) <= alignof(uint64_t), "RainState is under-aligned for this HashState");
+    return reinterpret_cast<State*>(state->opaque);
+  }
+
+  // Call fn with a null pointer of the HashState type for algorithm and bits
+  template <typename Fn>
+  bool dispatch(uint32_t algorithm, uint32_t bits, Fn fn) {
+    if (algorithm == RAIN_RAINBOW) {
+      switch (bits) {
+        case 64:  fn(static_cast<rainbow::HashState<64>*>(nullptr)); return true;
+        case 128: fn(static_cast<rainbow::HashState<128>*>(nullptr)); return true;
+        case 256: fn(static_cast<rainbow::HashState<256>*>(nullptr)); return true;
+      }
+    } else if (algorithm == RAIN_RAINSTORM) {
+      switch (bits) {
+        case 64:  fn(static_cast<rainstorm::HashState<64>*>(nullptr)); return true;
+        case 128: fn(static_cast<rainstorm::HashState<128>*>(nullptr)); return true;
+        case 256: fn(static_cast<rainstorm::HashState<256>*>(nullptr)); return true;
+        case 512: fn(static_cast<rainstorm::HashState<512>*>(nullptr)); return true;
+      }
+    }
+    return false;
+  }
+}
+
+extern "C" {
+  int rainAbiVersion(void) {
+    return RAIN_ABI_VERSION;
+  }
+
+  void rainbowHash64(const void* in, size_t len, uint64_t seed, void* out) {
+    rainbow::rainbow<64, bswap>(in, len, seed, out);
+  }
+
+  void rainbowHash128(const void* in, size_t len, uint64_t seed, void* out) {
+    rainbow::rainbow<128, bswap>(in, len, seed, out);
+  }
+
+  void rainbowHash256(const void* in, size_t len, uint64_t seed, void* out) {
+    rainbow::rainbow<256, bswap>(in, len, seed, out);
+  }
+
+  void rainstormHash64(const void* in, size_t len, uint64_t seed, void* out) {
+    rainstorm::rainstorm<64, bswap>(in, len, seed, out);
+  }
+
+  void rainstormHash128(const void* in, size_t len, uint64_t seed, void* out) {
+    rainstorm::rainstorm<128, bswap>(in, len, seed, out);
+  }
+
+  void rainstormHash256(const void* in, size_t len, uint64_t seed, void* out) {
+    rainstorm::rainstorm<256, bswap>(in, len, seed, out);
+  }
+
+  void rainstormHash512(const void* in, size_t len, uint64_t seed, void* out) {
+    rainstorm::rainstorm<512, bswap>(in, len, seed, out);
+  }
+
+  int rainInit(RainState* state, uint32_t algorithm, uint32_t bits, uint64_t seed, uint64_t total_len) {
+    bool ok = dispatch(algorithm, bits, [&](auto* type) {
+      using State = std::remove_pointer_t<decltype(type)>;
+      new (stateOf<State>(state)) State(State::initialize(seed, total_len));
+    });
+    if (!ok) {
+      // so later calls on this state fail rather than run on garbage
+      state->bits = 0;
+      return -1;
+    }
+    state->algorithm = algorithm;
+    state->bits = bits;
+    return 0;
+  }
+
+  int rainUpdate(RainState* state, const void* data, size_t len) {
+    bool updated = false;
+    dispatch(state->algorithm, state->bits, [&](auto* type) {
+      using State = std::remove_pointer_t<decltype(type)>;
+      State* s = stateOf<State>(state);
+      if (!s->finalized && len <= s->total_len - s->len) {
+        s->update(static_cast<const uint8_t*>(data), len);
+        updated = true;
+      }
+    });
+    return updated ? 0 : -1;
+  }
+
+  int rainFinal(RainState* state, void* out) {
+    bool finalized = false;
+    dispatch(state->algorithm, state->bits, [&](auto* type) {
+      using State = std::remove_pointer_t<decltype(type)>;
+      finalized = stateOf<State>(state)->finalize(out);
+    });
+    return finalized ? 0 : -1;
+  }
+}
@@ -0,0 +1,75 @@
+// Single translation unit for the WASM modules
+// The one-shot and streaming exports come from rainbow.cpp and rainstorm.cpp;
+// this adds tree-mode and multi-message exports. The same source is built
+// three ways (see the rainwasm target in the Makefile):
+//
+//   rain.wasm           scalar, runs everywhere
+//   rain-simd.wasm      -msimd128, multi-buffer Rainstorm runs in SIMD128
+//   rain-threads.wasm   SIMD128 plus pthreads, tree leaves are hashed by a
+//                       pool of web workers (needs SharedArrayBuffer)
+//
+// Tree digests are the ones `rainsum --tree` gives, whichever module computes them.
+
+#include "rainbow.cpp"
+#include "rainstorm.cpp"
+#include "multibuffer.h"
+#include "tree.h"
+
+#ifdef __EMSCRIPTEN__
+// workers started with the module, matching PTHREAD_POOL_SIZE
+#ifndef RAIN_WASM_THREADS
+#define RAIN_WASM_THREADS 8
+#endif
+
+namespace {
+  // Tree leaves run on this pool in the threaded module. Threads beyond the
+  // prestarted workers would only start once the caller yields, so the pool
+  // never asks for more than that.
+  WorkPool* treePool() {
+#ifdef __EMSCRIPTEN_PTHREADS__
+    static WorkPool pool(std::min<unsigned>(std::max(1u, std::thread::hardware_concurrency()), RAIN_WASM_THREADS));
+    return &pool;
+#else
+    return nullptr;
+#endif
+  }
+}
+
+extern "C" {
+  // Tree-mode digests of in-memory input. Return 0, or -1 for an unsupported size.
+  KEEPALIVE int rainstormTreeHash(const uint32_t hashsize, const void* in, const size_t len, const seed_t seed, void* out) {
+    switch (hashsize) {
+      case 64:  rainstorm::rainstorm_tree<64, false>(in, len, seed, out, treePool()); return 0;
+      case 128: rainstorm::rainstorm_tree<128, false>(in, len, seed, out, treePool()); return 0;
+      case 256: rainstorm::rainstorm_tree<256, false>(in, len, seed, out, treePool()); return 0;
+      case 512: rainstorm::rainstorm_tree<512, false>(in, len, seed, out, treePool()); return 0;
+    }
+    return -1;
+  }
+
+  KEEPALIVE int rainbowTreeHash(const uint32_t hashsize, const void* in, const size_t len, const seed_t seed, void* out) {
+    switch (hashsize) {
+      case 64:  rainbow::rainbow_tree<64, false>(in, len, seed, out, treePool()); return 0;
+      case 128: rainbow::rainbow_tree<128, false>(in, len, seed, out, treePool()); return 0;
+      case 256: rainbow::rainbow_tree<256, false>(in, len, seed, out, treePool()); return 0;
+    }
+    return -1;
+  }
+
+  // n independent messages (dedup chunks, records) through the multi-buffer
+  // kernels: message i is len[i] bytes at in[i], its digest goes to out + i * hashsize / 8
+  KEEPALIVE int rainstormHashMany(const uint32_t hashsize, const void* const* in, const size_t* len, const size_t n, const seed_t seed, uint8_t* out) {
+    std::vector<void*> outs(n);
+    for (size_t i = 0; i < n; i++) {
+      outs[i] = out + i * (hashsize / 8);
+    }
+    switch (hashsize) {
+      case 64:  rainstorm::rainstorm_many<64, false>(in, len, n, seed, outs.data()); return 0;
+      case 128: rainstorm::rainstorm_many<128, false>(in, len, n, seed, outs.data()); return 0;
+      case 256: rainstorm::rainstorm_many<256, false>(in, len, n, seed, outs.data()); return 0;
+      case 512: rainstorm::rainstorm_many<512, false>(in, len, n, seed, outs.data()); return 0;
+    }
+    return -1;
+  }
+}
+#endif
@@ -1,77 +1,324 @@
 #!/usr/bin/env node
-import chalk from 'chalk';
+// Cross-implementation throughput suite
+// Times the same hashes in-process in every implementation that is built:
+//
+//   native         rain/bin/rainbench (make rainbench), the C++ templates librain wraps
+//   wasm-scalar    wasm/rain.js          \
+//   wasm-simd      wasm/rain-simd.js      } through js/lib/api.mjs (make rainwasm)
+//   wasm-threads   wasm/rain-threads.js  /
+//
+// Each implementation runs in a child process of its own, so one module's
+// heap or worker threads never share a process with another's. The inputs
+// are prefixes of one corpus from a fixed-seed generator. rainbench times
+// its own fixed pattern, which gives the same throughput because neither
+// hash branches on its input. Every case is timed over repeated trials,
+// each one long enough to swamp timer noise, and reported as the mean GiB/s
+// with a 95% confidence interval. Nothing here starts a process per hash.
+//
+// Results are written as JSON with --out. With --baseline, every case is
+// compared with a stored run, and the exit status is 1 when a case is
+// missing or regressed: when even the top of its confidence interval is
+// more than --threshold below the baseline mean. make bench-baseline and
+// make bench-compare wrap the two.
+//
+//   node scripts/bench.mjs [--trials N] [--min-time MS] [--out FILE] [--baseline FILE] [--threshold FRACTION]
+
 import fs from 'fs';
-import {execSync, exec as callbackExec} from 'child_process';
-import util from 'util';
-const exec = util.promisify(callbackExec);
+import os from 'os';
+import path from 'path';
+import {spawnSync} from 'child_process';
+import {fileURLToPath} from 'url';
+
+const ROOT = path.resolve(path.dirname(fileURLToPath(import.meta.url)), '..');
+const RAINBENCH = path.join(ROOT, 'rain', 'bin', 'rainbench');
+
+const CORPUS_SEED = 0x7261696e;                               // "rain"
+const SIZES = [64, 1 << 10, 64 << 10, 1 << 20, 16 << 20];     // powers of 4, so rainbench's sweep has them all
+const TREE_SIZE = 16 << 20;
+const GIB = 1 << 30;
 
-// Generate files of various sizes
-async function generateFiles() {
-    for (let size = 1; size <= 8; size++) {
-        // Calculate size in bytes
-        let bytes = Math.pow(10, size);
+// Functions timed, with the rainbench row each one is
+const FUNCTIONS = [
+    {name: 'rainbow-256',        rainbench: 'rainbow<256>',   sizes: SIZES},
+    {name: 'rainstorm-512',      rainbench: 'rainstorm<512>', sizes: SIZES},
+    {name: 'rainstorm-512-tree', rainbench: null,             sizes: [TREE_SIZE]},
+];
+
+const WASM_VARIANTS = ['scalar', 'simd', 'threads'];
+
+function parseArgs(argv) {
+    const opts = {trials: 10, minTime: 50, out: null, baseline: null, threshold: 0.05, runWasm: null};
+    for (let i = 0; i < argv.length; i++) {
+        const arg = argv[i];
+        const value = () => {
+            if (i + 1 >= argv.length) {
+                throw new Error(`${arg} needs a value`);
+            }
+            return argv[++i];
+        };
+        if (arg === '--trials') {
+            opts.trials = Math.max(2, parseInt(value(), 10));
+        } else if (arg === '--min-time') {
+            opts.minTime = Math.max(1, Number(value()));
+        } else if (arg === '--out') {
+            opts.out = value();
+        } else if (arg === '--baseline') {
+            opts.baseline = value();
+        } else if (arg === '--threshold') {
+            opts.threshold = Number(value());
+        } else if (arg === '--run-wasm') {
+            opts.runWasm = value();                                   // internal: the child for one module
+        } else if (arg === '-h' || arg === '--help') {
+            console.log('Usage: node scripts/bench.mjs [--trials N] [--min-time MS] [--out FILE] [--baseline FILE] [--threshold FRACTION]\n' +
+                        '  --trials N          Timed trials per case, at least 2. Default: 10\n' +
+                        '  --min-time MS       Shortest WASM trial, calls are repeated until it is reached. Default: 50\n' +
+                        '  --out FILE          Write the results as JSON\n' +
+                        '  --baseline FILE     Compare with stored results, exit 1 on a regression\n' +
+                        '  --threshold F       Slowdown allowed before a case regresses. Default: 0.05');
+            process.exit(0);
+        } else {
+            throw new Error(`Unknown option ${arg}`);
+        }
+    }
+    if (!(opts.threshold >= 0 && opts.threshold < 1)) {
+        throw new Error('--threshold must be a fraction from 0 to 1');
+    }
+    return opts;
+}
 
-        // Generate a file with `dd`
-        execSync(`dd if=/dev/urandom of=input${size} bs=${bytes} count=1 > /dev/null 2>&1`);
+// Deterministic input bytes, xorshift32 from CORPUS_SEED
+function corpus(length) {
+    const words = new Uint32Array(Math.ceil(length / 4));
+    let x = CORPUS_SEED;
+    for (let i = 0; i < words.length; i++) {
+        x ^= x << 13;
+        x ^= x >>> 17;
+        x ^= x << 5;
+        words[i] = x >>> 0;
     }
+    return new Uint8Array(words.buffer, 0, length);
 }
 
-// Define your test inputs here
-const inputs = ["input1", "input2", "input3", "input4", "input5", "input6", "input7", "input8"];
+// Two-sided 95% Student t quantiles for 1 to 30 degrees of freedom
+const T95 = [12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+             2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+             2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042];
 
-async function timeExecution(command) {
-    const start = process.hrtime.bigint();
-    await exec(command);
-    const end = process.hrtime.bigint();
-    return end - start;
+function summarize(trials) {
+    const n = trials.length;
+    const mean = trials.reduce((a, b) => a + b, 0) / n;
+    const variance = n > 1 ? trials.reduce((a, b) => a + (b - mean) ** 2, 0) / (n - 1) : 0;
+    const stddev = Math.sqrt(variance);
+    const half = (n > 1 ? (T95[n - 2] ?? 1.960) : 0) * stddev / Math.sqrt(n);
+    return {mean, stddev, ci95: [mean - half, mean + half]};
 }
 
-async function main() {
-    await generateFiles();
+// Child process: time every case on one WASM module, print the trials as JSON
+async function runWasm(variant, opts) {
+    const api = await import('../js/lib/api.mjs');
+    try {
+        await api.loadRainVariant(variant);
+    } catch (e) {
+        console.log(JSON.stringify({error: `${e.message ?? e}`}));
+        process.exit(0);
+    }
+    const hashes = {
+        'rainbow-256':        (seed, input) => api.rainbowHash(256, seed, input),
+        'rainstorm-512':      (seed, input) => api.rainstormHash(512, seed, input),
+        'rainstorm-512-tree': (seed, input) => api.rainstormTreeHash(512, seed, input),
+    };
+    const data = corpus(Math.max(...SIZES, TREE_SIZE));
+    const timeCalls = async (hash, input, calls) => {
+        const start = process.hrtime.bigint();
+        for (let i = 0; i < calls; i++) {
+            await hash(i, input);
+        }
+        return Number(process.hrtime.bigint() - start) / 1e9;
+    };
+
+    const results = [];
+    for (const fn of FUNCTIONS) {
+        for (const bytes of fn.sizes) {
+            const input = data.subarray(0, bytes);
+            // double the calls until a trial takes min-time, which is also the warmup
+            let calls = 1;
+            while (await timeCalls(hashes[fn.name], input, calls) < opts.minTime / 1e3 && calls < (1 << 24)) {
+                calls *= 2;
+            }
+            const trials = [];
+            for (let t = 0; t < opts.trials; t++) {
+                trials.push(bytes * calls / await timeCalls(hashes[fn.name], input, calls) / GIB);
+            }
+            results.push({function: fn.name, bytes, trials});
+        }
+    }
+    console.log(JSON.stringify({results}));
+    // the threaded module's workers would otherwise keep the process alive
+    process.exit(0);
+}
 
-    console.log(chalk.bold("\nRain hash functions C++ vs Node/WASM benchmark:\n"));
+function measureWasm(variant, opts) {
+    const implementation = `wasm-${variant}`;
+    const module = path.join(ROOT, 'wasm', variant === 'scalar' ? 'rain.js' : `rain-${variant}.js`);
+    if (!fs.existsSync(module)) {
+        return {implementation, skipped: `${path.relative(ROOT, module)} is not built (make rainwasm)`};
+    }
+    const child = spawnSync(process.execPath, [fileURLToPath(import.meta.url), '--run-wasm', variant,
+                                               '--trials', String(opts.trials), '--min-time', String(opts.minTime)],
+                            {encoding: 'utf8', stdio: ['ignore', 'pipe', 'inherit'], maxBuffer: 1 << 24});
+    if (child.status !== 0) {
+        throw new Error(`${implementation} run failed with status ${child.status}`);
+    }
+    const output = JSON.parse(child.stdout.trim().split('\n').pop());
+    if (output.error) {
+        return {implementation, skipped: output.error};
+    }
+    return {implementation, results: output.results};
+}
 
-    const title = `${'Test Input & Size (bytes)'.padEnd(31)} ${'Run'.padStart(5)} ${'C++ Version'.padStart(18)} ${'WASM Version'.padStart(18)} ${'Fastest'.padStart(16)}`;
-    console.log(chalk.bold(title));
+// One rainbench run per trial, taking the median GiB/s of each row it times
+function measureNative(opts) {
+    const implementation = 'native';
+    if (!fs.existsSync(RAINBENCH)) {
+        return {implementation, skipped: 'rain/bin/rainbench is not built (make rainbench)'};
+    }
+    const trials = new Map();
+    for (let t = 0; t < opts.trials; t++) {
+        const run = spawnSync(RAINBENCH, ['--csv', '--max-size', String(Math.max(...SIZES)), '--samples', '5'],
+                              {encoding: 'utf8', stdio: ['ignore', 'pipe', 'inherit'], maxBuffer: 1 << 24});
+        if (run.status !== 0) {
+            throw new Error(`rainbench failed with status ${run.status}`);
+        }
+        for (const line of run.stdout.split('\n')) {
+            const [kind, name, bytes, , , gibs] = line.split(',');
+            const fn = FUNCTIONS.find(f => f.rainbench === name);
+            if (kind !== 'throughput' || !fn || !fn.sizes.includes(Number(bytes))) {
+                continue;
+            }
+            const key = `${fn.name},${bytes}`;
+            trials.set(key, [...(trials.get(key) ?? []), Number(gibs)]);
+        }
+    }
+    const results = [...trials].map(([key, values]) => {
+        const [name, bytes] = key.split(',');
+        return {function: name, bytes: Number(bytes), trials: values};
+    });
+    return {implementation, results};
+}
 
-    // Run each test three times
-    for (let run = 1; run <= 3; run++) {
-        for (let input of inputs) {
-            // Get input file size
-            const stats = fs.statSync(input);
-            const fileSizeInBytes = stats.size.toLocaleString();
+function sizeName(bytes) {
+    const units = ['B', 'KiB', 'MiB', 'GiB'];
+    let unit = 0;
+    while (bytes >= 1024 && bytes % 1024 === 0 && unit < 3) {
+        bytes /= 1024;
+        unit++;
+    }
+    return `${bytes} ${units[unit]}`;
+}
 
-            // Running and timing the CPP version
-            const time_cpp = await timeExecution(`./rainsum ${input} > /dev/null 2>&1`);
+const caseKey = r => `${r.implementation} ${r.function} ${r.bytes}`;
 
-            // Running and timing the NodeJS version
-            const time_js = await timeExecution(`node ./js/rainsum.mjs ${input} > /dev/null 2>&1`);
+function printTable(report) {
+    const implementations = ['native', ...WASM_VARIANTS.map(v => `wasm-${v}`)];
+    console.log('\nThroughput in GiB/s, mean ± 95% confidence interval');
+    console.log(`${'function'.padEnd(20)} ${'size'.padStart(8)}` + implementations.map(i => i.padStart(18)).join(''));
+    for (const fn of FUNCTIONS) {
+        for (const bytes of fn.sizes) {
+            let row = `${fn.name.padEnd(20)} ${sizeName(bytes).padStart(8)}`;
+            for (const implementation of implementations) {
+                const r = report.results.find(x => x.implementation === implementation && x.function === fn.name && x.bytes === bytes);
+                const cell = r ? `${r.mean.toFixed(3)} ±${((r.ci95[1] - r.ci95[0]) / 2).toFixed(3)}` : '-';
+                row += cell.padStart(18);
+            }
+            console.log(row);
+        }
+    }
+    for (const s of report.skipped) {
+        console.log(`${s.implementation}: skipped, ${s.reason}`);
+    }
+}
 
-            // Calculate which is faster
-            let faster;
-            let color;
-            if (time_cpp < time_js) {
-                faster = Number(time_js / time_cpp).toFixed(2) + "x (C++ wins!)";
-                color = chalk.green;
+// Exit status for a comparison with a stored run: 1 if any case regressed or is missing
+function compare(report, baseline, threshold) {
+    const current = new Map(report.results.map(r => [caseKey(r), r]));
+    let failed = 0;
+    console.log(`\nAgainst ${baseline.date ?? 'the baseline'}, failing below ${((1 - threshold) * 100).toFixed(0)}% of its mean`);
+    for (const base of baseline.results) {
+        const cur = current.get(caseKey(base));
+        let status;
+        let detail;
+        if (!cur) {
+            status = 'MISSING';
+            detail = `${base.mean.toFixed(3)} GiB/s in the baseline, not measured now`;
+            failed++;
+        } else {
+            const change = (cur.mean / base.mean - 1) * 100;
+            detail = `${base.mean.toFixed(3)} -> ${cur.mean.toFixed(3)} GiB/s (${change >= 0 ? '+' : ''}${change.toFixed(1)}%)`;
+            if (cur.ci95[1] < base.mean * (1 - threshold)) {
+                status = 'REGRESSED';
+                failed++;
+            } else if (cur.ci95[0] > base.mean * (1 + threshold)) {
+                status = 'faster';
             } else {
-                faster = Number(time_cpp / time_js).toFixed(2) + "x (NodeJS wins!)";
-                color = chalk.blue;
+                status = 'ok';
             }
-
-            const row = `${input} (${fileSizeInBytes} bytes)`.padEnd(35) + `${run.toString().padEnd(4)} ${time_cpp.toLocaleString().padStart(14)} ns ${time_js.toLocaleString().padStart(14)} ns ${faster.padStart(22)}`;
-            console.log(color(row));
         }
+        console.log(`${status.padEnd(10)} ${caseKey(base).padEnd(44)} ${detail}`);
+    }
+    if (failed) {
+        console.log(`\n${failed} case${failed > 1 ? 's' : ''} regressed or missing`);
+    }
+    return failed ? 1 : 0;
+}
+
+async function main() {
+    const opts = parseArgs(process.argv.slice(2));
+    if (opts.runWasm) {
+        return runWasm(opts.runWasm, opts);
     }
+    const baseline = opts.baseline ? JSON.parse(fs.readFileSync(opts.baseline, 'utf8')) : null;
 
-    // Teardown step: delete generated files
-    for (let input of inputs) {
-        try {
-            fs.unlinkSync(input);
-        } catch (err) {
-            console.error(`Error while deleting ${input}. ${err}`);
+    const report = {
+        suite: 'rain-bench',
+        version: 1,
+        date: new Date().toISOString(),
+        host: {
+            platform: process.platform,
+            arch: process.arch,
+            cpu: os.cpus()[0]?.model ?? 'unknown',
+            cpus: os.cpus().length,
+            node: process.version,
+            rain_isa: process.env.RAIN_ISA ?? null,
+        },
+        config: {trials: opts.trials, min_time_ms: opts.minTime, corpus_seed: CORPUS_SEED, sizes: SIZES, tree_size: TREE_SIZE},
+        results: [],
+        skipped: [],
+    };
+
+    const runs = [() => measureNative(opts), ...WASM_VARIANTS.map(v => () => measureWasm(v, opts))];
+    for (const measure of runs) {
+        const run = measure();
+        if (run.skipped) {
+            report.skipped.push({implementation: run.implementation, reason: run.skipped});
+            continue;
+        }
+        for (const r of run.results) {
+            report.results.push({implementation: run.implementation, ...r, ...summarize(r.trials)});
         }
     }
-}
 
-main();
+    printTable(report);
+    if (opts.out) {
+        fs.mkdirSync(path.dirname(path.resolve(opts.out)), {recursive: true});
+        fs.writeFileSync(opts.out, JSON.stringify(report, null, 2) + '\n');
+        console.log(`\nResults written to ${opts.out}`);
+    }
+    if (baseline) {
+        process.exitCode = compare(report, baseline, opts.threshold);
+    }
+}
 
+main().catch(e => {
+    console.error(`bench: ${e.message ?? e}`);
+    process.exit(2);
+});
@@ -11,3 +11,24 @@ echo "Rainbow test vectors:"
 ./js/rainsum.mjs --test-vectors
 echo "Rainstorm test vectors:"
 ./js/rainsum.mjs --test-vectors -a storm
+echo "C++ Rainstorm round variants"
+for rounds in 2 6 8; do
+  echo "Rainstorm $rounds-round test vectors:"
+  ./rainsum --test-vectors -a storm --rounds $rounds
+done
+echo "C++ Merkle directory roots"
+dir=$(mktemp -d)
+mkdir -p "$dir/tree/sub"
+printf '' > "$dir/tree/empty"
+printf 'The quick brown fox jumps over the lazy dog' > "$dir/tree/fox.txt"
+printf 'After the rainstorm comes the rainbow.' > "$dir/tree/sub/rain.txt"
+rainsum="$(pwd)/rainsum"
+(cd "$dir" && "$rainsum" -r --merkle tree && "$rainsum" -a storm -s 512 -r --merkle tree)
+rm -rf "$dir"
+echo "C++ tree index with a dirty range to end of file"
+dir=$(mktemp -d)
+head -c 3500000 /dev/zero | tr '\0' 'r' > "$dir/big"
+(cd "$dir" && "$rainsum" --tree --index d.rix big > /dev/null)
+printf 'RAIN' | dd of="$dir/big" bs=1 seek=2500000 conv=notrunc status=none
+(cd "$dir" && "$rainsum" --tree --index d.rix --dirty 1+18446744073709551615 big && "$rainsum" --tree --index d.rix big && "$rainsum" --tree big)
+rm -rf "$dir"
@@ -0,0 +1,232 @@
+#pragma once
+
+// Content-defined chunking (FastCDC-style)
+// A Gear rolling hash, fp = (fp << 1) + GEAR[byte], runs over the input and a
+// chunk ends where the top bits of fp are all zero. Cut points depend only on
+// the bytes near them, so an insert or delete moves the boundaries of the
+// chunks around it and no others, and deduplication still finds the rest.
+// As in FastCDC, no cut is looked for in the first min_size bytes, a stricter
+// mask is used until avg_size and a looser one after it (normalized chunking,
+// which keeps sizes close to the average), and chunks end at max_size at most.
+// The gear table is derived from Rainbow's P..W constants.
+//
+// digestChunks() and digestChunkStream() also digest every chunk, giving the
+// (offset, length, digest) records of `rainsum --chunks`, and
+// rainbow_chunks / rainstorm_chunks at the bottom wrap them for one hash.
+//
+// Include rainbow.cpp before this header, and for rainstorm_chunks
+// rainstorm.cpp and multibuffer.h too.
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace raincdc {
+  constexpr size_t   DEFAULT_AVG_SIZE = 8192;
+  constexpr size_t   MIN_AVG_SIZE     = 256;
+  constexpr size_t   MAX_AVG_SIZE     = 16 << 20;
+  constexpr size_t   CHUNK_BATCH      = 8;          // chunks digested together, one full set of multi-buffer lanes
+  constexpr size_t   MAX_DIGEST_SIZE  = 64;
+
+  constexpr uint64_t gearEntry(size_t i) {
+    const uint64_t K[8] = {rainbow::P, rainbow::Q, rainbow::R, rainbow::S, rainbow::T, rainbow::U, rainbow::V, rainbow::W};
+    uint64_t x = (i + 1) * K[i % 8];
+    x ^= x >> 31;
+    x *= K[(i + 3) % 8];
+    x ^= x >> 29;
+    x *= K[(i + 5) % 8];
+    x ^= x >> 32;
+    return x;
+  }
+
+  constexpr std::array<uint64_t, 256> makeGear() {
+    std::array<uint64_t, 256> gear{};
+    for (size_t i = 0; i < gear.size(); i++) {
+      gear[i] = gearEntry(i);
+    }
+    return gear;
+  }
+
+  static constexpr std::array<uint64_t, 256> GEAR = makeGear();
+
+  struct Params {
+    size_t   min_size;
+    size_t   avg_size;
+    size_t   max_size;
+    uint64_t mask_small;            // before avg_size: two more bits than the average needs
+    uint64_t mask_large;            // after it: two fewer
+
+    // min_size is a quarter of the average and max_size eight times it
+    static Params forAverage(size_t avg_size) {
+      if (avg_size < MIN_AVG_SIZE || avg_size > MAX_AVG_SIZE || (avg_size & (avg_size - 1))) {
+        throw std::runtime_error("Average chunk size must be a power of two from " + std::to_string(MIN_AVG_SIZE) + " to " + std::to_string(MAX_AVG_SIZE) + " bytes");
+      }
+      int bits = 0;
+      while ((size_t(1) << bits) < avg_size) {
+        bits++;
+      }
+      Params params;
+      params.min_size = avg_size / 4;
+      params.avg_size = avg_size;
+      params.max_size = avg_size * 8;
+      params.mask_small = ~UINT64_C(0) << (64 - (bits + 2));
+      params.mask_large = ~UINT64_C(0) << (64 - (bits - 2));
+      return params;
+    }
+  };
+
+  // Length of the chunk that starts at data, where len is everything left of
+  // the input (or at least max_size bytes of it)
+  static inline size_t cut(const uint8_t* data, size_t len, const Params& params) {
+    if (len <= params.min_size) {
+      return len;
+    }
+    size_t end = std::min(len, params.max_size);
+    size_t normal = std::min(end, params.avg_size);
+    uint64_t fp = 0;
+    size_t i = params.min_size;
+    for (; i < normal; i++) {
+      fp = (fp << 1) + GEAR[data[i]];
+      if (!(fp & params.mask_small)) {
+        return i + 1;
+      }
+    }
+    for (; i < end; i++) {
+      fp = (fp << 1) + GEAR[data[i]];
+      if (!(fp & params.mask_large)) {
+        return i + 1;
+      }
+    }
+    return end;
+  }
+
+  // Call emit(offset, chunk, chunk_len) for every chunk of an in-memory input
+  template <typename Emit>
+  static void split(const uint8_t* data, size_t len, const Params& params, Emit emit) {
+    uint64_t offset = 0;
+    while (offset < len) {
+      size_t n = cut(data + offset, len - offset, params);
+      emit(offset, data + offset, n);
+      offset += n;
+    }
+  }
+
+  // The same for input from read(dst, max), which returns 0 at the end. The
+  // chunk passed to emit is only valid during the call. Memory use is a
+  // buffer of a few max_size chunks, however long the input.
+  template <typename Read, typename Emit>
+  static void splitStream(Read read, const Params& params, Emit emit) {
+    std::vector<uint8_t> buffer(4 * params.max_size);
+    size_t start = 0, filled = 0;
+    uint64_t offset = 0;
+    bool eof = false;
+
+    while (true) {
+      // keep at least max_size bytes ahead of the cut point, so cut() sees
+      // the input exactly as split() would
+      while (!eof && filled - start < params.max_size) {
+        if (start > 0) {
+          std::memmove(buffer.data(), buffer.data() + start, filled - start);
+          filled -= start;
+          start = 0;
+        }
+        size_t n = read(buffer.data() + filled, buffer.size() - filled);
+        eof = n == 0;
+        filled += n;
+      }
+      if (start == filled) {
+        return;
+      }
+      size_t n = cut(buffer.data() + start, filled - start, params);
+      emit(offset, buffer.data() + start, n);
+      offset += n;
+      start += n;
+    }
+  }
+
+  // Split an in-memory input and digest every chunk. many(in, len, n, out)
+  // digests n <= CHUNK_BATCH chunks into digest_len bytes each, and
+  // emit(offset, chunk_len, digest) is called for each chunk in order, with
+  // the digest valid during the call.
+  template <typename Many, typename Emit>
+  static void digestChunks(const uint8_t* data, size_t len, const Params& params, size_t digest_len, Many many, Emit emit) {
+    if (digest_len > MAX_DIGEST_SIZE) {
+      throw std::runtime_error("Chunk digests are at most " + std::to_string(MAX_DIGEST_SIZE) + " bytes");
+    }
+    uint8_t digests[CHUNK_BATCH * MAX_DIGEST_SIZE];
+    const void* in[CHUNK_BATCH];
+    size_t lens[CHUNK_BATCH];
+    void* out[CHUNK_BATCH];
+    uint64_t offsets[CHUNK_BATCH];
+    size_t pending = 0;
+    for (size_t i = 0; i < CHUNK_BATCH; i++) {
+      out[i] = digests + i * digest_len;
+    }
+    auto flush = [&] {
+      many(in, lens, pending, out);
+      for (size_t i = 0; i < pending; i++) {
+        emit(offsets[i], lens[i], static_cast<const uint8_t*>(out[i]));
+      }
+      pending = 0;
+    };
+    split(data, len, params, [&](uint64_t offset, const uint8_t* chunk, size_t n) {
+      in[pending] = chunk;
+      lens[pending] = n;
+      offsets[pending] = offset;
+      if (++pending == CHUNK_BATCH) {
+        flush();
+      }
+    });
+    if (pending) {
+      flush();
+    }
+  }
+
+  // The same for input from read(dst, max). Chunks only live until the next
+  // read, so they are digested one at a time.
+  template <typename Read, typename Many, typename Emit>
+  static void digestChunkStream(Read read, const Params& params, size_t digest_len, Many many, Emit emit) {
+    if (digest_len > MAX_DIGEST_SIZE) {
+      throw std::runtime_error("Chunk digests are at most " + std::to_string(MAX_DIGEST_SIZE) + " bytes");
+    }
+    uint8_t digest[MAX_DIGEST_SIZE];
+    splitStream(read, params, [&](uint64_t offset, const uint8_t* chunk, size_t n) {
+      const void* in = chunk;
+      void* out = digest;
+      many(&in, &n, 1, &out);
+      emit(offset, n, static_cast<const uint8_t*>(digest));
+    });
+  }
+}
+
+// Chunk and digest with one hash: emit(offset, chunk_len, digest) for every
+// chunk of in, at an average chunk size of avg_size
+#ifdef __RAINBNOWVERSION__
+namespace rainbow {
+  template <uint32_t hashsize, bool bswap, typename Emit>
+  static void rainbow_chunks(const void* in, const size_t len, size_t avg_size, const seed_t seed, Emit emit) {
+    auto many = [seed](const void* const* chunk, const size_t* chunk_len, size_t n, void* const* out) {
+      for (size_t i = 0; i < n; i++) {
+        rainbow<hashsize, bswap>(chunk[i], chunk_len[i], seed, out[i]);
+      }
+    };
+    raincdc::digestChunks(static_cast<const uint8_t*>(in), len, raincdc::Params::forAverage(avg_size), hashsize / 8, many, emit);
+  }
+}
+#endif
+
+#ifdef __STORMVERSION__
+namespace rainstorm {
+  template <uint32_t hashsize, bool bswap, int rounds = ROUNDS, typename Emit>
+  static void rainstorm_chunks(const void* in, const size_t len, size_t avg_size, const seed_t seed, Emit emit) {
+    auto many = [seed](const void* const* chunk, const size_t* chunk_len, size_t n, void* const* out) {
+      rainstorm_many<hashsize, bswap, rounds>(chunk, chunk_len, n, seed, out);
+    };
+    raincdc::digestChunks(static_cast<const uint8_t*>(in), len, raincdc::Params::forAverage(avg_size), hashsize / 8, many, emit);
+  }
+}
+#endif
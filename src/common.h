@@ -11,15 +11,40 @@ constexpr bool bswap = true;
 #endif
 
 #define ROTR64(x, n) (((x) >> (n)) | ((x) << (64 - (n))))
+// Default read size for pipes and other streams; hashing itself works on any
+// update granularity
 constexpr size_t CHUNK_SIZE = 16384;
 
 typedef uint64_t seed_t;
 
 struct IHashState {
     virtual void update(const uint8_t* chunk, size_t chunk_len) = 0;
-    virtual void finalize(void* out) = 0;
+    virtual bool finalize(void* out) = 0;
     virtual ~IHashState() = default;
-    size_t len;
+};
+
+// Type-erased wrapper so the CLI can pick a HashState<hashsize> at runtime.
+// Embedders should use the HashState templates directly and skip the vtable.
+template <typename State>
+struct ErasedHashState : IHashState {
+    State state;
+    explicit ErasedHashState(const State& state) : state(state) {}
+    void update(const uint8_t* chunk, size_t chunk_len) override { state.update(chunk, chunk_len); }
+    bool finalize(void* out) override { return state.finalize(out); }
+};
+
+// Streaming state behind the WASM exports. JavaScript copies each chunk into
+// input and calls update, so memory use stays the same however long the input.
+constexpr size_t WASM_STREAM_BUFFER = 1 << 16;
+
+struct WasmStream {
+    IHashState* state;
+    uint8_t input[WASM_STREAM_BUFFER];
+
+    explicit WasmStream(IHashState* state) : state(state) {}
+    ~WasmStream() { delete state; }
+    WasmStream(const WasmStream&) = delete;
+    WasmStream& operator=(const WasmStream&) = delete;
 };
 
 template <bool bswap>
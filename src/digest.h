@@ -0,0 +1,633 @@
+#pragma once
+
+// The per-file digest path: one-shot, tree and multi-buffer dispatch, the
+// per-thread HashArena and the streaming loops over mapped, read and piped
+// input. rainsum hashes every file through here, and rainbench calls the same
+// functions to check that a warmed-up thread digests files without touching
+// the heap.
+
+#include <array>
+#include <cstddef>
+#include <cstdio>
+#include <istream>
+#include <memory>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "tool.h"
+#include "pool.h"
+#include "multibuffer.h"
+#include "tree.h"
+#include "reader.h"
+#include "kernels.h"
+
+// Call fn with a --rounds count as a std::integral_constant, so the Rainstorm
+// templates get it at compile time. Only the counts listed are instantiated.
+template<typename Fn>
+void withRounds(int rounds, Fn fn) {
+  switch(rounds) {
+    case 2: fn(std::integral_constant<int, 2>()); break;
+    case 4: fn(std::integral_constant<int, 4>()); break;
+    case 6: fn(std::integral_constant<int, 6>()); break;
+    case 8: fn(std::integral_constant<int, 8>()); break;
+    default:
+      throw std::runtime_error("Unsupported Rainstorm round count " + std::to_string(rounds) + " (expected 2, 4, 6 or 8)");
+  }
+}
+
+// One-shot digests go through the kernels built for the active ISA (kernels.h)
+template<bool bswap>
+void invokeHash(HashAlgorithm algot, uint64_t seed, const uint8_t* data, size_t len, uint8_t* out, int hash_size, int rounds = rainstorm::ROUNDS) {
+  static_assert(bswap == ::bswap, "The ISA kernels are built for the host byte order");
+  const rainisa::Kernels& kernels = rainisa::activeKernels();
+  if(algot == HashAlgorithm::Rainbow) {
+    switch(hash_size) {
+      case 64:
+        kernels.rainbow[0](data, len, seed, out);
+        break;
+      case 128:
+        kernels.rainbow[1](data, len, seed, out);
+        break;
+      case 256:
+        kernels.rainbow[2](data, len, seed, out);
+        break;
+      default:
+        throw std::runtime_error("Invalid hash_size for rainbow");
+    }
+  } else if(algot == HashAlgorithm::Rainstorm) {
+    const rainisa::hash_fn* sizes = kernels.rainstorm[rainisa::roundIndex(rounds)];
+    switch(hash_size) {
+      case 64:
+        sizes[0](data, len, seed, out);
+        break; // NOTE: I'm not sure whether it's a bug or an intentional approach. Assuming similar as Rainbow.
+      case 128:
+        sizes[1](data, len, seed, out);
+        break;
+      case 256:
+        sizes[2](data, len, seed, out);
+        break;
+      case 512:
+        sizes[3](data, len, seed, out);
+        break;
+      default:
+        throw std::runtime_error("Invalid hash_size for rainstorm");
+    }
+  } else {
+    throw std::runtime_error("Invalid algorithm: " + hashAlgoToString(algot));
+  }
+}
+
+template<bool bswap>
+void invokeTree(HashAlgorithm algot, uint64_t seed, const uint8_t* data, size_t len, uint8_t* out, int hash_size, WorkPool* pool, int rounds = rainstorm::ROUNDS) {
+  if(algot == HashAlgorithm::Rainbow) {
+    switch(hash_size) {
+      case 64:
+        rainbow::rainbow_tree<64, bswap>(data, len, seed, out, pool);
+        break;
+      case 128:
+        rainbow::rainbow_tree<128, bswap>(data, len, seed, out, pool);
+        break;
+      case 256:
+        rainbow::rainbow_tree<256, bswap>(data, len, seed, out, pool);
+        break;
+      default:
+        throw std::runtime_error("Invalid hash_size for rainbow");
+    }
+  } else if(algot == HashAlgorithm::Rainstorm) {
+    withRounds(rounds, [&](auto r) {
+      switch(hash_size) {
+        case 64:
+          rainstorm::rainstorm_tree<64, bswap, r>(data, len, seed, out, pool);
+          break;
+        case 128:
+          rainstorm::rainstorm_tree<128, bswap, r>(data, len, seed, out, pool);
+          break;
+        case 256:
+          rainstorm::rainstorm_tree<256, bswap, r>(data, len, seed, out, pool);
+          break;
+        case 512:
+          rainstorm::rainstorm_tree<512, bswap, r>(data, len, seed, out, pool);
+          break;
+        default:
+          throw std::runtime_error("Invalid hash_size for rainstorm");
+      }
+    });
+  } else {
+    throw std::runtime_error("Invalid algorithm: " + hashAlgoToString(algot));
+  }
+}
+
+// Hash n messages with the same seed, Rainstorm runs them through the multi-buffer kernels
+template<bool bswap>
+void invokeMany(HashAlgorithm algot, uint64_t seed, const void* const* in, const size_t* len, size_t n, void* const* out, int hash_size, int rounds = rainstorm::ROUNDS) {
+  if(algot == HashAlgorithm::Rainstorm) {
+    withRounds(rounds, [&](auto r) {
+      switch(hash_size) {
+        case 64:
+          rainstorm::rainstorm_many<64, bswap, r>(in, len, n, seed, out);
+          break;
+        case 128:
+          rainstorm::rainstorm_many<128, bswap, r>(in, len, n, seed, out);
+          break;
+        case 256:
+          rainstorm::rainstorm_many<256, bswap, r>(in, len, n, seed, out);
+          break;
+        case 512:
+          rainstorm::rainstorm_many<512, bswap, r>(in, len, n, seed, out);
+          break;
+        default:
+          throw std::runtime_error("Invalid hash_size for rainstorm");
+      }
+    });
+  } else {
+    for (size_t i = 0; i < n; i++) {
+      invokeHash<bswap>(algot, seed, static_cast<const uint8_t*>(in[i]), len[i], static_cast<uint8_t*>(out[i]), hash_size);
+    }
+  }
+}
+
+// Plain or tree digest of an input that is entirely in memory
+inline void digestMemory(const HashOptions& opts, const uint8_t* data, size_t len, Digest& digest) {
+  PhaseTimer timer(opts.stats, Phase::Hash);
+  if (opts.stats) {
+    opts.stats->addBytes(len);
+  }
+  if (opts.tree) {
+    invokeTree<bswap>(opts.algot, opts.seed, data, len, digest.data(), opts.size, opts.pool, opts.rounds);
+  } else {
+    invokeHash<bswap>(opts.algot, opts.seed, data, len, digest.data(), opts.size, opts.rounds);
+  }
+}
+
+// Room for whichever HashState makeHashState picks, so choosing one at
+// runtime does not need the heap
+class HashStateSlot {
+  public:
+    HashStateSlot() = default;
+    ~HashStateSlot() {
+      reset();
+    }
+
+    HashStateSlot(const HashStateSlot&) = delete;
+    HashStateSlot& operator=(const HashStateSlot&) = delete;
+
+    template<typename State>
+    IHashState& emplace(const State& state) {
+      static_assert(sizeof(ErasedHashState<State>) <= sizeof(storage), "HashStateSlot is too small for this HashState");
+      static_assert(alignof(ErasedHashState<State>) <= alignof(std::max_align_t), "HashStateSlot is under-aligned for this HashState");
+      reset();
+      current = new (storage) ErasedHashState<State>(state);
+      return *current;
+    }
+
+    void reset() {
+      if (current) {
+        current->~IHashState();
+        current = nullptr;
+      }
+    }
+
+  private:
+    alignas(std::max_align_t) unsigned char storage[256];
+    IHashState* current = nullptr;
+};
+
+// Per-thread scratch space for hashing files. Buffers grow to the largest size
+// asked of them and are kept, so once a worker has hashed a few files, hashing
+// more of the same kind allocates nothing.
+struct HashArena {
+  std::vector<uint8_t> chunk;                             // streamed reads
+  std::vector<uint8_t> input;                             // small files and short stdin, read whole
+  std::array<std::vector<uint8_t>, BATCH_GROUP> group;    // the small files of one batch group
+  HashStateSlot state;
+#ifndef _WIN32
+  ReadBuffers blocks;                                     // PipelinedReader blocks, for large files
+#endif
+
+  static HashArena& local() {
+    thread_local HashArena arena;
+    return arena;
+  }
+
+  static uint8_t* reserve(std::vector<uint8_t>& buffer, size_t len) {
+    if (buffer.size() < len) {
+      buffer.resize(len);
+    }
+    return buffer.data();
+  }
+};
+
+inline IHashState& makeHashState(HashStateSlot& slot, HashAlgorithm algot, uint64_t seed, uint64_t input_length, uint32_t size, int rounds) {
+  if(algot == HashAlgorithm::Rainbow) {
+    switch(size) {
+      case 64:
+        return slot.emplace(rainbow::HashState<64>::initialize(seed, input_length));
+      case 128:
+        return slot.emplace(rainbow::HashState<128>::initialize(seed, input_length));
+      case 256:
+        return slot.emplace(rainbow::HashState<256>::initialize(seed, input_length));
+      default:
+        throw std::runtime_error("Invalid hash_size for rainbow");
+    }
+  } else if(algot == HashAlgorithm::Rainstorm) {
+    IHashState* state = nullptr;
+    withRounds(rounds, [&](auto r) {
+      switch(size) {
+        case 64:
+          state = &slot.emplace(rainstorm::HashState<64, bswap, r>::initialize(seed, input_length));
+          break;
+        case 128:
+          state = &slot.emplace(rainstorm::HashState<128, bswap, r>::initialize(seed, input_length));
+          break;
+        case 256:
+          state = &slot.emplace(rainstorm::HashState<256, bswap, r>::initialize(seed, input_length));
+          break;
+        case 512:
+          state = &slot.emplace(rainstorm::HashState<512, bswap, r>::initialize(seed, input_length));
+          break;
+        default:
+          throw std::runtime_error("Invalid hash_size for rainstorm");
+      }
+    });
+    return *state;
+  } else {
+    throw std::runtime_error("Invalid algorithm: " + hashAlgoToString(algot));
+  }
+}
+
+// Feed everything read(dst, max) yields into a fresh state, chunk_size bytes at a time
+template<typename Reader>
+void hashChunks(const HashOptions& opts, IHashState& state, Reader read, uint8_t* chunk, size_t chunk_size) {
+  while (true) {
+    size_t bytes_read;
+    {
+      PhaseTimer timer(opts.stats, Phase::Read);
+      bytes_read = read(chunk, chunk_size);
+    }
+    {
+      PhaseTimer timer(opts.stats, Phase::Hash);
+      state.update(chunk, bytes_read);
+    }
+    if (opts.stats) {
+      opts.stats->addBytes(bytes_read);
+    }
+    // A short read means the input is exhausted
+    if (bytes_read < chunk_size) {
+      break;
+    }
+  }
+}
+
+// Chaining values of n tree leaves
+inline void hashLeaves(const HashOptions& opts, const void* const* leaf_in, const size_t* leaf_len, size_t n, void* const* leaf_cv) {
+  PhaseTimer timer(opts.stats, Phase::Hash);
+  if (opts.algot == HashAlgorithm::Rainbow) {
+    raintree::leaves<raintree::each<rainbow::rainbow<256, bswap>>>(leaf_in, leaf_len, n, opts.seed, leaf_cv);
+  } else {
+    withRounds(opts.rounds, [&](auto r) {
+      raintree::leaves<rainstorm::rainstorm_many<512, bswap, r>>(leaf_in, leaf_len, n, opts.seed, leaf_cv);
+    });
+  }
+}
+
+inline size_t treeCvSize(HashAlgorithm algot) {
+  return algot == HashAlgorithm::Rainbow ? rainbow::TREE_CV_SIZE : rainstorm::TREE_CV_SIZE;
+}
+
+// Tree digest of input_length bytes from read(dst, max), reading one round of
+// leaves into memory at a time and hashing each round on the pool
+template<typename Reader>
+void digestTreeChunks(const HashOptions& opts, Reader read, uint64_t input_length, Digest& digest) {
+  auto readLeaf = [&](uint8_t* dst, size_t want) {
+    PhaseTimer timer(opts.stats, Phase::Read);
+    size_t got = 0;
+    while (got < want) {
+      size_t bytes_read = read(dst + got, want - got);
+      if (bytes_read == 0) {
+        throw std::runtime_error("Input ended after " + std::to_string(got) + " of " + std::to_string(want) + " bytes of a tree leaf.");
+      }
+      got += bytes_read;
+    }
+  };
+
+  uint64_t leaves = raintree::leafCount(input_length);
+  // Each round holds one group of leaves per worker in memory
+  size_t round = raintree::LEAF_GROUP * (opts.pool ? opts.pool->size() : 1);
+  size_t leaf_buffer = std::min<uint64_t>(raintree::LEAF_SIZE, input_length);
+  std::vector<std::vector<uint8_t>> buffers(std::min<uint64_t>(round, leaves));
+
+  // On a pool spread over NUMA nodes, each group's buffers are zeroed, which
+  // places their pages, by a worker of the node that will hash that group
+  unsigned nodes = opts.pool ? opts.pool->nodes() : 1;
+  auto groupNode = [&](size_t slot) {
+    return nodes > 1 ? opts.pool->nodeAt(slot / raintree::LEAF_GROUP % nodes) : -1;
+  };
+  TaskGroup tasks(nodes > 1 ? opts.pool : nullptr);
+  for (size_t slot = 0; slot < buffers.size(); slot += raintree::LEAF_GROUP) {
+    size_t end = std::min(buffers.size(), slot + raintree::LEAF_GROUP);
+    tasks.run([&buffers, slot, end, leaf_buffer] {
+      for (size_t i = slot; i < end; i++) {
+        buffers[i].resize(leaf_buffer);
+      }
+    }, groupNode(slot));
+  }
+  tasks.wait();
+
+  if (opts.stats) {
+    opts.stats->addBytes(input_length);
+  }
+  if (leaves == 1) {
+    readLeaf(buffers[0].data(), input_length);
+    PhaseTimer timer(opts.stats, Phase::Hash);
+    invokeHash<bswap>(opts.algot, opts.seed, buffers[0].data(), input_length, digest.data(), opts.size, opts.rounds);
+    return;
+  }
+
+  size_t cv_size = treeCvSize(opts.algot);
+  std::vector<uint8_t> cvs(leaves * cv_size);
+
+  TaskGroup leaf_tasks(opts.pool);
+  for (uint64_t first = 0; first < leaves; first += buffers.size()) {
+    uint64_t last = std::min<uint64_t>(leaves, first + buffers.size());
+    for (uint64_t group = first; group < last; group += raintree::LEAF_GROUP) {
+      size_t n = std::min<uint64_t>(raintree::LEAF_GROUP, last - group);
+      std::vector<const void*> leaf_in(n);
+      std::vector<size_t> leaf_len(n);
+      std::vector<void*> leaf_cv(n);
+      for (size_t i = 0; i < n; i++) {
+        uint64_t leaf = group + i;
+        leaf_in[i] = buffers[leaf - first].data();
+        leaf_len[i] = std::min<uint64_t>(raintree::LEAF_SIZE, input_length - leaf * raintree::LEAF_SIZE);
+        leaf_cv[i] = cvs.data() + leaf * cv_size;
+        readLeaf(buffers[leaf - first].data(), leaf_len[i]);
+      }
+      leaf_tasks.run([&opts, leaf_in, leaf_len, leaf_cv, n] {
+        hashLeaves(opts, leaf_in.data(), leaf_len.data(), n, leaf_cv.data());
+      }, groupNode(group - first));
+    }
+    leaf_tasks.wait();
+  }
+
+  PhaseTimer timer(opts.stats, Phase::Finalize);
+  std::vector<uint8_t> node = raintree::parentNode(cvs.data(), cvs.size(), input_length);
+  invokeHash<bswap>(opts.algot, opts.seed ^ raintree::PARENT_DOMAIN, node.data(), node.size(), digest.data(), opts.size, opts.rounds);
+}
+
+// Digest input whose length is unknown up front (stdin, pipes, devices)
+inline void digestUnsized(const HashOptions& opts, std::istream& in_stream, Digest& digest) {
+    HashArena& arena = HashArena::local();
+    size_t chunk_size = opts.block_size ? opts.block_size : CHUNK_SIZE;
+    uint8_t* chunk = HashArena::reserve(arena.chunk, chunk_size);
+
+    // Small inputs are hashed straight from memory
+    size_t buffered = 0;
+    while (in_stream && buffered < STDIN_BUFFER_LIMIT) {
+      PhaseTimer timer(opts.stats, Phase::Read);
+      uint8_t* buffer = HashArena::reserve(arena.input, buffered + chunk_size);
+      in_stream.read(reinterpret_cast<char*>(buffer + buffered), chunk_size);
+      buffered += in_stream.gcount();
+    }
+    if (in_stream.bad()) {
+      throw std::runtime_error("Input could not be read after " + std::to_string(buffered) + " bytes.");
+    }
+
+    if (!in_stream) {
+      digestMemory(opts, arena.input.data(), buffered, digest);
+      return;
+    }
+
+    // Larger inputs are spooled to a temporary file so we learn the length
+    // the state is initialized with, while holding only one chunk in memory
+    std::unique_ptr<FILE, decltype(&std::fclose)> spool(std::tmpfile(), &std::fclose);
+    if (!spool) {
+      throw std::runtime_error("Cannot create temporary file to spool input");
+    }
+    uint64_t input_length = 0;
+    auto spoolBytes = [&](const uint8_t* data, size_t len) {
+      if (std::fwrite(data, 1, len, spool.get()) != len) {
+        throw std::runtime_error("Cannot spool input after " + std::to_string(input_length) + " bytes.");
+      }
+      input_length += len;
+    };
+    spoolBytes(arena.input.data(), buffered);
+    while (in_stream) {
+      PhaseTimer timer(opts.stats, Phase::Read);
+      in_stream.read(reinterpret_cast<char*>(chunk), chunk_size);
+      spoolBytes(chunk, in_stream.gcount());
+    }
+    if (in_stream.bad()) {
+      throw std::runtime_error("Input could not be read after " + std::to_string(input_length) + " bytes.");
+    }
+    std::rewind(spool.get());
+
+    auto readSpool = [&](uint8_t* dst, size_t max) {
+      size_t bytes_read = std::fread(dst, 1, max, spool.get());
+      if (bytes_read < max && std::ferror(spool.get())) {
+        throw std::runtime_error("Spooled input could not be read.");
+      }
+      return bytes_read;
+    };
+
+    if (opts.tree) {
+      digestTreeChunks(opts, readSpool, input_length, digest);
+      return;
+    }
+
+    IHashState& state = makeHashState(arena.state, opts.algot, opts.seed, input_length, opts.size, opts.rounds);
+    hashChunks(opts, state, readSpool, chunk, chunk_size);
+    PhaseTimer timer(opts.stats, Phase::Finalize);
+    if (!state.finalize(digest.data())) {
+      throw std::runtime_error("Spooled input changed length while it was read.");
+    }
+}
+
+// Digest a named file, mapping it when possible
+inline void digestFile(const HashOptions& opts, const std::string& inpath, Digest& digest) {
+    HashArena& arena = HashArena::local();
+    if (opts.use_mmap) {
+      // Regular files are mapped and hashed in place with the one-shot hash,
+      // pipes and special files fall through to read() below
+      std::optional<MappedFile> mapped;
+      {
+        PhaseTimer timer(opts.stats, Phase::Read);
+        mapped.emplace(inpath, &arena.input);
+      }
+      if (mapped->data) {
+        digestMemory(opts, mapped->data, mapped->size, digest);
+        return;
+      }
+    }
+
+    if (!isRegularFile(inpath)) {
+      std::ifstream infile(inpath, std::ios::binary);
+      if (infile.fail()) {
+        throw std::runtime_error("Cannot open file for reading: " + inpath);
+      }
+      digestUnsized(opts, infile, digest);
+      return;
+    }
+
+#ifndef _WIN32
+    // Regular files are read through a pipeline that keeps several large
+    // reads in flight while we hash
+    // Small files take one read into a buffer the thread keeps, not a pipeline
+    if (!opts.direct) {
+      int fd = open(inpath.c_str(), O_RDONLY);
+      struct stat st;
+      if (fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && static_cast<uint64_t>(st.st_size) <= SMALL_FILE_READ) {
+        bool whole;
+        {
+          PhaseTimer timer(opts.stats, Phase::Read);
+          whole = readWhole(fd, st.st_size, arena.input);
+        }
+        close(fd);
+        if (!whole) {
+          throw std::runtime_error("Input file could not be read: " + inpath);
+        }
+        digestMemory(opts, arena.input.data(), st.st_size, digest);
+        return;
+      }
+      if (fd >= 0) {
+        close(fd);
+      }
+    }
+
+    PipelinedReader reader(inpath, opts.direct, ioBlockSize(opts, inpath), &arena.blocks);
+    uint64_t input_length = reader.size();
+
+    if (opts.tree) {
+      digestTreeChunks(opts, [&](uint8_t* dst, size_t max) { return reader.read(dst, max); }, input_length, digest);
+      return;
+    }
+
+    IHashState& state = makeHashState(arena.state, opts.algot, opts.seed, input_length, opts.size, opts.rounds);
+    while (true) {
+      const uint8_t* block;
+      size_t len;
+      {
+        PhaseTimer timer(opts.stats, Phase::Read);
+        len = reader.next(&block);
+      }
+      if (len == 0) {
+        break;
+      }
+      PhaseTimer timer(opts.stats, Phase::Hash);
+      state.update(block, len);
+      if (opts.stats) {
+        opts.stats->addBytes(len);
+      }
+    }
+#else
+    std::ifstream infile(inpath, std::ios::binary);
+    if (infile.fail()) {
+      throw std::runtime_error("Cannot open file for reading: " + inpath);
+    }
+    uint64_t input_length = getFileSize(inpath);
+
+    auto readFile = [&](uint8_t* dst, size_t max) {
+      infile.read(reinterpret_cast<char*>(dst), max);
+      if (infile.fail() && !infile.eof()) {
+        throw std::runtime_error("Input file could not be read: " + inpath);
+      }
+      return static_cast<size_t>(infile.gcount());
+    };
+
+    if (opts.tree) {
+      digestTreeChunks(opts, readFile, input_length, digest);
+      return;
+    }
+
+    IHashState& state = makeHashState(arena.state, opts.algot, opts.seed, input_length, opts.size, opts.rounds);
+    size_t chunk_size = ioBlockSize(opts, inpath);
+    hashChunks(opts, state, readFile, HashArena::reserve(arena.chunk, chunk_size), chunk_size);
+#endif
+
+    PhaseTimer timer(opts.stats, Phase::Finalize);
+    if (!state.finalize(digest.data())) {
+      throw std::runtime_error("Input changed length while it was read: " + inpath);
+    }
+}
+
+// Digest a group of batch entries, errors[i] is empty when entry i succeeded.
+// Mapped Rainstorm files of the same size are hashed together in the multi-buffer kernel.
+// This runs as a WorkPool task, so failures go to errors rather than escaping.
+inline void digestGroup(const HashOptions& opts, const std::vector<BatchEntry>& group, std::vector<Digest>& digests, std::vector<std::string>& errors) {
+    if (group.size() > BATCH_GROUP) {
+      throw std::logic_error("Batch group of " + std::to_string(group.size()) + " entries is over BATCH_GROUP");
+    }
+    digests.resize(group.size());
+    errors.assign(group.size(), std::string());
+    HashArena& arena = HashArena::local();
+    std::array<std::optional<MappedFile>, BATCH_GROUP> maps;
+    bool lanes = opts.algot == HashAlgorithm::Rainstorm && opts.use_mmap && !opts.tree;
+
+    std::array<bool, BATCH_GROUP> done{};
+    for (size_t i = 0; i < group.size(); i++) {
+      try {
+        uint32_t size = group[i].size ? group[i].size : opts.size;
+        digests[i].resize(size / 8);
+        if (lanes) {
+          PhaseTimer timer(opts.stats, Phase::Read);
+          maps[i].emplace(group[i].path, &arena.group[i]);
+        }
+      } catch (const std::exception& e) {
+        maps[i].reset();
+        errors[i] = e.what();
+        done[i] = true;
+      }
+    }
+
+    for (size_t i = 0; i < group.size(); i++) {
+      if (done[i] || !maps[i] || !maps[i]->data) {
+        continue;
+      }
+      const void* in[BATCH_GROUP];
+      size_t len[BATCH_GROUP];
+      void* out[BATCH_GROUP];
+      size_t entry[BATCH_GROUP];
+      size_t n = 0;
+      for (size_t j = i; j < group.size(); j++) {
+        if (!done[j] && maps[j] && maps[j]->data && digests[j].size() == digests[i].size()) {
+          in[n] = maps[j]->data;
+          len[n] = maps[j]->size;
+          out[n] = digests[j].data();
+          entry[n] = j;
+          n++;
+          done[j] = true;
+        }
+      }
+      try {
+        FileTimer timer(opts.stats, n);
+        PhaseTimer hash_timer(opts.stats, Phase::Hash);
+        invokeMany<bswap>(opts.algot, opts.seed, in, len, n, out, digests[i].size() * 8, opts.rounds);
+        if (opts.stats) {
+          for (size_t k = 0; k < n; k++) {
+            opts.stats->addBytes(len[k]);
+          }
+        }
+      } catch (const std::exception& e) {
+        // every lane of the call shares the failure
+        for (size_t k = 0; k < n; k++) {
+          errors[entry[k]] = e.what();
+        }
+      }
+    }
+
+    HashOptions entry_opts = opts;
+    entry_opts.pool = nullptr;
+    for (size_t i = 0; i < group.size(); i++) {
+      if (done[i]) {
+        continue;
+      }
+      try {
+        FileTimer timer(opts.stats);
+        entry_opts.size = digests[i].size() * 8;
+        digestFile(entry_opts, group[i].path, digests[i]);
+      } catch (const std::exception& e) {
+        errors[i] = e.what();
+      }
+    }
+}
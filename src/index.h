@@ -0,0 +1,169 @@
+#pragma once
+
+// Sidecar index for --index
+// Stores the tree-mode chaining value of every leaf of a file, with the file's
+// size, mtime, inode and device and the algorithm and seed they were made
+// with. When the file is hashed again, leaves that cannot have changed keep
+// their chaining values and only the rest are read, then the parent node is
+// rebuilt. A leaf is re-read when
+//   - the file's size or mtime moved and no dirty ranges were given (so any
+//     leaf may have changed),
+//   - it overlaps a dirty range the caller passed in, or
+//   - it is new, or its length changed, because the file grew or shrank.
+// Leaves that are entirely holes (SEEK_DATA/SEEK_HOLE) are never read: their
+// chaining value is that of a leaf of zeros.
+//
+// The file is little-endian: an 8-byte magic, eleven 64-bit header fields,
+// then the chaining values in leaf order.
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "common.h"
+
+constexpr char     INDEX_MAGIC[8] = {'R', 'A', 'I', 'N', 'I', 'D', 'X', '\0'};
+constexpr uint64_t INDEX_VERSION  = 1;
+constexpr size_t   INDEX_HEADER   = 8 + 11 * 8;
+
+struct FileIdentity {
+  uint64_t size = 0;
+  int64_t  mtime_sec = 0;
+  int64_t  mtime_nsec = 0;
+  uint64_t inode = 0;
+  uint64_t device = 0;
+
+#ifndef _WIN32
+  static FileIdentity of(const struct stat& st) {
+    FileIdentity id;
+    id.size = st.st_size;
+#ifdef __APPLE__
+    id.mtime_sec = st.st_mtimespec.tv_sec;
+    id.mtime_nsec = st.st_mtimespec.tv_nsec;
+#else
+    id.mtime_sec = st.st_mtim.tv_sec;
+    id.mtime_nsec = st.st_mtim.tv_nsec;
+#endif
+    id.inode = st.st_ino;
+    id.device = st.st_dev;
+    return id;
+  }
+#endif
+
+  bool sameFile(const FileIdentity& other) const {
+    return inode == other.inode && device == other.device;
+  }
+
+  bool unchanged(const FileIdentity& other) const {
+    return sameFile(other) && size == other.size && mtime_sec == other.mtime_sec && mtime_nsec == other.mtime_nsec;
+  }
+};
+
+struct TreeIndex {
+  uint64_t     algorithm = 0;
+  uint64_t     seed = 0;
+  FileIdentity file;
+  uint64_t     leaf_size = 0;
+  uint64_t     cv_size = 0;
+  uint64_t     leaves = 0;
+  std::vector<uint8_t> cvs;
+
+  // False when there is no index at path or it is not one we can use
+  bool load(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    uint8_t header[INDEX_HEADER];
+    if (!in.read(reinterpret_cast<char*>(header), sizeof(header)) || std::memcmp(header, INDEX_MAGIC, 8) != 0) {
+      return false;
+    }
+    uint64_t fields[11];
+    for (int i = 0; i < 11; i++) {
+      fields[i] = GET_U64<bswap>(header, 8 + i * 8);
+    }
+    if (fields[0] != INDEX_VERSION) {
+      return false;
+    }
+    algorithm = fields[1];
+    seed = fields[2];
+    file.size = fields[3];
+    file.mtime_sec = static_cast<int64_t>(fields[4]);
+    file.mtime_nsec = static_cast<int64_t>(fields[5]);
+    file.inode = fields[6];
+    file.device = fields[7];
+    leaf_size = fields[8];
+    cv_size = fields[9];
+    leaves = fields[10];
+    if (cv_size == 0 || cv_size > 64 || leaves > (UINT64_C(1) << 40)) {
+      return false;
+    }
+    cvs.resize(leaves * cv_size);
+    return static_cast<bool>(in.read(reinterpret_cast<char*>(cvs.data()), cvs.size()));
+  }
+
+  // Written next to path and renamed over it, so a crash never leaves half an index
+  void save(const std::string& path) const {
+    uint8_t header[INDEX_HEADER];
+    std::memcpy(header, INDEX_MAGIC, 8);
+    const uint64_t fields[11] = {INDEX_VERSION, algorithm, seed, file.size, static_cast<uint64_t>(file.mtime_sec),
+                                 static_cast<uint64_t>(file.mtime_nsec), file.inode, file.device, leaf_size, cv_size, leaves};
+    for (int i = 0; i < 11; i++) {
+      PUT_U64<bswap>(fields[i], header, 8 + i * 8);
+    }
+    std::string temp = path + ".tmp";
+    {
+      std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+      out.write(reinterpret_cast<const char*>(header), sizeof(header));
+      out.write(reinterpret_cast<const char*>(cvs.data()), cvs.size());
+      if (!out.flush()) {
+        std::remove(temp.c_str());
+        throw std::runtime_error("Cannot write index: " + temp);
+      }
+    }
+    if (std::rename(temp.c_str(), path.c_str()) != 0) {
+      std::remove(temp.c_str());
+      throw std::runtime_error("Cannot replace index: " + path);
+    }
+  }
+};
+
+#ifndef _WIN32
+// has_data[i] is false when leaf i lies entirely in a hole. Filesystems
+// without SEEK_DATA report every leaf as data.
+static inline std::vector<bool> dataLeaves(int fd, uint64_t size, uint64_t leaf_size) {
+  uint64_t leaves = (size + leaf_size - 1) / leaf_size;
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+  std::vector<bool> has_data(leaves, false);
+  off_t offset = 0;
+  while (static_cast<uint64_t>(offset) < size) {
+    off_t data = lseek(fd, offset, SEEK_DATA);
+    if (data < 0) {
+      if (errno == ENXIO) {
+        return has_data;            // only holes from offset to the end
+      }
+      return std::vector<bool>(leaves, true);
+    }
+    off_t hole = lseek(fd, data, SEEK_HOLE);
+    if (hole < 0) {
+      return std::vector<bool>(leaves, true);
+    }
+    for (uint64_t leaf = data / leaf_size; leaf < leaves && leaf * leaf_size < static_cast<uint64_t>(hole); leaf++) {
+      has_data[leaf] = true;
+    }
+    offset = hole;
+  }
+  return has_data;
+#else
+  (void)fd;
+  return std::vector<bool>(leaves, true);
+#endif
+}
+#endif
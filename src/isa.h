@@ -0,0 +1,133 @@
+#pragma once
+
+// Instruction set selection
+// Distributable builds use the compiler's baseline target, so the hash kernels
+// are also built once per wider ISA (kernels.h, isa_*.cpp) and the widest one
+// the CPU supports is picked the first time one is needed: cpuid on x86,
+// getauxval(AT_HWCAP) on 32-bit ARM. AArch64 always has NEON. The choice can
+// be pinned for A/B runs with RAIN_ISA=scalar|avx2|avx512|neon in the
+// environment, or with rainsum's --isa, which calls select() before hashing.
+// A choice the CPU cannot run falls back to the best one it can. This header
+// never prints: environmentProblem() and select() report a fallback, and the
+// tools decide whether to warn.
+
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#if defined(__arm__) && defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+namespace rainisa {
+  enum class Isa {
+    Scalar,
+    Avx2,
+    Avx512,
+    Neon
+  };
+
+  static inline const char* name(Isa isa) {
+    switch (isa) {
+      case Isa::Avx2:   return "avx2";
+      case Isa::Avx512: return "avx512";
+      case Isa::Neon:   return "neon";
+      default:          return "scalar";
+    }
+  }
+
+  static inline Isa parse(const std::string& text) {
+    for (Isa isa : {Isa::Scalar, Isa::Avx2, Isa::Avx512, Isa::Neon}) {
+      if (text == name(isa)) {
+        return isa;
+      }
+    }
+    throw std::runtime_error("Unknown ISA '" + text + "' (expected scalar, avx2, avx512 or neon)");
+  }
+
+  static inline bool supported(Isa isa) {
+    switch (isa) {
+      case Isa::Scalar:
+        return true;
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(__EMSCRIPTEN__)
+      // the AVX2 kernels also use BMI2 (rorx), which every AVX2 CPU but a few early VIA parts has
+      case Isa::Avx2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2");
+      case Isa::Avx512:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl") && __builtin_cpu_supports("bmi2");
+#endif
+#if defined(__aarch64__)
+      case Isa::Neon:
+        return true;
+#elif defined(__arm__) && defined(__linux__)
+      case Isa::Neon:
+        return (getauxval(AT_HWCAP) & HWCAP_NEON) != 0;
+#endif
+      default:
+        return false;
+    }
+  }
+
+  static inline Isa best() {
+    for (Isa isa : {Isa::Avx512, Isa::Avx2, Isa::Neon}) {
+      if (supported(isa)) {
+        return isa;
+      }
+    }
+    return Isa::Scalar;
+  }
+
+  // The message for running fallback in place of isa
+  static inline std::string fallbackMessage(Isa isa, Isa fallback) {
+    return std::string("this CPU cannot run ") + name(isa) + " kernels, using " + name(fallback);
+  }
+
+  // The RAIN_ISA choice, or the best one when it is unset or cannot be
+  // followed, in which case problem says why
+  static inline Isa fromEnvironment(std::string& problem) {
+    const char* forced = std::getenv("RAIN_ISA");
+    if (!forced || !*forced) {
+      return best();
+    }
+    try {
+      Isa isa = parse(forced);
+      if (supported(isa)) {
+        return isa;
+      }
+      problem = fallbackMessage(isa, best());
+    } catch (const std::runtime_error& e) {
+      problem = e.what();
+    }
+    return best();
+  }
+
+  // Why RAIN_ISA was not followed, empty when it was or is unset. Only
+  // meaningful once active() has been called.
+  inline std::string& environmentProblem() {
+    static std::string problem;
+    return problem;
+  }
+
+  // One choice per process, shared by every translation unit
+  inline Isa& current() {
+    static Isa isa = fromEnvironment(environmentProblem());
+    return isa;
+  }
+
+  inline Isa active() {
+    return current();
+  }
+
+  // Override the choice. Only before the first hash: kernels that were
+  // already picked keep their choice. False when the CPU cannot run isa and
+  // active() is the best one it can run instead.
+  inline bool select(Isa isa) {
+    bool runnable = supported(isa);
+    current() = runnable ? isa : best();
+    return runnable;
+  }
+}
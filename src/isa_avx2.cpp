@@ -0,0 +1,23 @@
+// AVX2 and BMI2 build of the hash kernels, see kernels.h
+// BMI2 adds rorx, a rotate that does not overwrite its source register.
+#include "kernels.h"
+
+#ifdef RAIN_ISA_X86
+#ifdef __clang__
+#pragma clang attribute push(__attribute__((target("avx2,bmi,bmi2"))), apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("avx2,bmi,bmi2")
+#endif
+
+#include "rainbow.cpp"
+#include "rainstorm.cpp"
+
+RAIN_DEFINE_KERNELS(avx2_kernels, Isa::Avx2)
+
+#ifdef __clang__
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+#endif
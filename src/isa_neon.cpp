@@ -0,0 +1,15 @@
+// NEON build of the hash kernels for 32-bit ARM, see kernels.h
+// AArch64 always has NEON, so there the scalar build already uses it.
+#include "kernels.h"
+
+#ifdef RAIN_ISA_ARM32
+#pragma GCC push_options
+#pragma GCC target("fpu=neon")
+
+#include "rainbow.cpp"
+#include "rainstorm.cpp"
+
+RAIN_DEFINE_KERNELS(neon_kernels, Isa::Neon)
+
+#pragma GCC pop_options
+#endif
@@ -0,0 +1,6 @@
+// Baseline build of the hash kernels, see kernels.h
+#include "kernels.h"
+#include "rainbow.cpp"
+#include "rainstorm.cpp"
+
+RAIN_DEFINE_KERNELS(scalar_kernels, Isa::Scalar)
@@ -0,0 +1,97 @@
+#pragma once
+
+// Per-ISA builds of the one-shot hashes
+// Each isa_*.cpp includes this header, switches the code generation target
+// with a pragma and then includes rainbow.cpp and rainstorm.cpp, so their
+// block loops, the Rainbow mixers and Rainstorm's weakfunc, are compiled
+// again for that ISA. Every function in those files has internal linkage, so
+// the copies never meet at link time, and the standard headers are all parsed
+// here first so none of their inline functions take on the wider target.
+// RAIN_DEFINE_KERNELS then fills in the table of entry points.
+//
+// activeKernels() is the table for rainisa::active(). It is only linked into
+// rainsum and rainbench, which build the isa_*.cpp files. AArch64 has NEON in
+// its baseline, so there its neon table is the scalar one. AVX-512 runs the
+// AVX2 table: built for AVX-512, GCC moves the serial weakfunc chain through
+// vector registers and Rainstorm gets about 40% slower, so AVX-512 is left to
+// the multi-buffer kernels, which do gain from it.
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include "common.h"
+#include "isa.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(__EMSCRIPTEN__)
+#define RAIN_ISA_X86 1
+#elif defined(__arm__) && defined(__linux__)
+#define RAIN_ISA_ARM32 1
+#endif
+
+namespace rainisa {
+  typedef void (*hash_fn)(const void* in, const size_t len, const seed_t seed, void* out);
+
+  // Rainstorm round counts with a kernel, the ones --rounds accepts
+  constexpr int ROUND_COUNTS = 4;
+
+  static inline int roundIndex(int rounds) {
+    if (rounds < 2 || rounds > 2 * ROUND_COUNTS || rounds % 2) {
+      throw std::runtime_error("Unsupported Rainstorm round count " + std::to_string(rounds) + " (expected 2, 4, 6 or 8)");
+    }
+    return rounds / 2 - 1;
+  }
+
+  struct Kernels {
+    Isa     isa;
+    hash_fn rainbow[3];                       // 64, 128, 256 bits
+    hash_fn rainstorm[ROUND_COUNTS][4];       // [roundIndex][64, 128, 256, 512 bits]
+  };
+
+  extern const Kernels scalar_kernels;
+#ifdef RAIN_ISA_X86
+  extern const Kernels avx2_kernels;
+#endif
+#ifdef RAIN_ISA_ARM32
+  extern const Kernels neon_kernels;
+#endif
+
+  static inline const Kernels& kernelsFor(Isa isa) {
+    switch (isa) {
+#ifdef RAIN_ISA_X86
+      case Isa::Avx2:
+      case Isa::Avx512: return avx2_kernels;
+#endif
+#ifdef RAIN_ISA_ARM32
+      case Isa::Neon:   return neon_kernels;
+#endif
+      default:          return scalar_kernels;
+    }
+  }
+
+  inline const Kernels& activeKernels() {
+    static const Kernels& kernels = kernelsFor(active());
+    return kernels;
+  }
+}
+
+#define RAIN_STORM_SIZES(rounds) \
+  {rainstorm::rainstorm<64, bswap, rounds>, rainstorm::rainstorm<128, bswap, rounds>, \
+   rainstorm::rainstorm<256, bswap, rounds>, rainstorm::rainstorm<512, bswap, rounds>}
+
+#define RAIN_DEFINE_KERNELS(table, isa_value)                                                     \
+  namespace rainisa {                                                                             \
+    extern const Kernels table;                                                                   \
+    const Kernels table = {                                                                       \
+      isa_value,                                                                                  \
+      {rainbow::rainbow<64, bswap>, rainbow::rainbow<128, bswap>, rainbow::rainbow<256, bswap>}, \
+      {RAIN_STORM_SIZES(2), RAIN_STORM_SIZES(4), RAIN_STORM_SIZES(6), RAIN_STORM_SIZES(8)}        \
+    };                                                                                            \
+  }
@@ -0,0 +1,59 @@
+#pragma once
+
+// Counter-mode keystream
+// Block i of the keystream is the 512-bit Rainstorm hash of key || le64(i),
+// under the seed offset by a domain constant. Every block depends only on its
+// index, so any offset costs the same to reach and ranges can be generated on
+// as many threads or machines as you like. Blocks are hashed eight at a time
+// through the multi-buffer kernels, where all lanes have the same length.
+//
+// Include rainstorm.cpp and multibuffer.h before this header.
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+
+namespace rainstorm {
+  constexpr size_t   KEYSTREAM_BLOCK  = 64;
+  constexpr uint64_t KEYSTREAM_DOMAIN = UINT64_C(0x7261696e2d637472);   // "rain-ctr"
+
+  // Write len bytes of the keystream for key and seed, starting at byte offset
+  template <bool bswap = ::bswap>
+  static void keystream(const void* key, size_t key_len, const seed_t seed, uint64_t offset, void* out, size_t len) {
+    constexpr size_t lanes = 8;
+    const size_t message_len = key_len + 8;
+    std::vector<uint8_t> messages(lanes * message_len);
+    const void* in[lanes];
+    size_t in_len[lanes];
+    void* block_out[lanes];
+    uint8_t blocks[lanes][KEYSTREAM_BLOCK];
+
+    for (size_t l = 0; l < lanes; l++) {
+      std::memcpy(messages.data() + l * message_len, key, key_len);
+      in[l] = messages.data() + l * message_len;
+      in_len[l] = message_len;
+      block_out[l] = blocks[l];
+    }
+
+    uint8_t* dst = static_cast<uint8_t*>(out);
+    uint64_t counter = offset / KEYSTREAM_BLOCK;
+    size_t within = offset % KEYSTREAM_BLOCK;
+
+    while (len > 0) {
+      for (size_t l = 0; l < lanes; l++) {
+        PUT_U64<bswap>(counter + l, messages.data() + l * message_len, key_len);
+      }
+      rainstorm_many<512, bswap>(in, in_len, lanes, seed ^ KEYSTREAM_DOMAIN, block_out);
+
+      for (size_t l = 0; l < lanes && len > 0; l++) {
+        size_t take = std::min(len, KEYSTREAM_BLOCK - within);
+        std::memcpy(dst, blocks[l] + within, take);
+        dst += take;
+        len -= take;
+        within = 0;
+      }
+      counter += lanes;
+    }
+  }
+}
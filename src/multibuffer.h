@@ -0,0 +1,204 @@
+#pragma once
+
+// Multi-buffer Rainstorm: hash 4 or 8 independent messages at once
+// The chain inside weakfunc is serial within one state, but the states of
+// separate messages are independent, so word i of every lane's state lives in
+// one SIMD vector and each weakfunc step runs across all lanes. Lanes move in
+// lockstep over the blocks they all have. When every lane has the same number
+// of blocks (tree leaves, fixed-size records, short keys) the padding block and
+// finalization run in SIMD as well, otherwise each lane is finished by the scalar
+// code. The output is bit for bit the same as rainstorm<hashsize, bswap, rounds>.
+//
+// The kernel is written with GCC/Clang vector extensions, so the same source
+// becomes SSE2/AVX2/AVX-512 on x86, NEON on ARM and SIMD128 on WASM. On x86
+// the version for rainisa::active() (isa.h) is picked once at first use, so
+// RAIN_ISA pins it along with the one-shot kernels.
+//
+// Include rainstorm.cpp before this header.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include "isa.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(__EMSCRIPTEN__)
+#define RAIN_X86_DISPATCH 1
+#endif
+
+namespace rainstorm {
+  typedef void (*lanes_fn)(const void* const* in, const size_t* len, const seed_t seed, void* const* out);
+
+  template <int lanes>
+  struct Lanes {
+    typedef uint64_t vec __attribute__((vector_size(8 * lanes)));
+  };
+
+  // weakfunc across lanes, same steps as the scalar version
+  template <typename vec>
+  static inline __attribute__((always_inline)) void weakfunc_lanes(vec* h, const vec* data, bool left) {
+    vec ctr;
+    if ( left ) {
+      ctr = vec{} + CTR_LEFT;
+#pragma GCC unroll 8
+      for (int i = 0, j = 1, k = 8; i < 8; i++, j++, k++) {
+        h[i] ^= data[i];
+        h[i] -= K[i];
+        h[i] = (h[i] >> Z[i]) | (h[i] << (64 - Z[i]));
+        h[k] ^= h[i];
+        ctr += h[i];
+        h[j] -= ctr;
+      }
+    } else {
+      ctr = vec{} + CTR_RIGHT;
+#pragma GCC unroll 8
+      for (int i = 8, j = 0, k = 1; i < 16; i++, j++, k++) {
+        h[i] ^= data[j];
+        h[i] -= K[j];
+        h[i] = (h[i] >> Z[j]) | (h[i] << (64 - Z[j]));
+        h[j] ^= h[i];
+        ctr += h[i];
+        h[(k&7)+8] -= ctr;
+      }
+    }
+  }
+
+  template <int lanes, uint32_t hashsize, bool bswap, int rounds>
+  static inline __attribute__((always_inline)) void lanes_kernel(const void* const* in, const size_t* len, const seed_t seed, void* const* out) {
+    typedef typename Lanes<lanes>::vec vec;
+    const uint8_t* data[lanes];
+    uint64_t lane_h[16];
+    uint64_t lane_temp[8];
+    vec h[16];
+    vec temp[8];
+
+    uint64_t blocks = len[0] / 64;
+    bool same_blocks = true;
+    for (int l = 0; l < lanes; l++) {
+      data[l] = static_cast<const uint8_t*>(in[l]);
+      same_blocks &= len[l] / 64 == blocks;
+      blocks = std::min<uint64_t>(blocks, len[l] / 64);
+
+      initState(lane_h, seed, len[l]);
+      for (int k = 0; k < 16; k++) {
+        h[k][l] = lane_h[k];
+      }
+    }
+
+    // Process the 512-bit blocks all lanes have
+    for (uint64_t b = 0; b < blocks; b++) {
+      for (int i = 0; i < 8; i++) {
+        for (int l = 0; l < lanes; l++) {
+          temp[i][l] = GET_U64<bswap>(data[l], i * 8);
+        }
+      }
+
+      for (int i = 0; i < rounds; i++) {
+        weakfunc_lanes(h, temp, i & 1);
+      }
+
+      for (int l = 0; l < lanes; l++) {
+        data[l] += 64;
+      }
+    }
+
+    if (!same_blocks) {
+      for (int l = 0; l < lanes; l++) {
+        for (int k = 0; k < 16; k++) {
+          lane_h[k] = h[k][l];
+        }
+        finish<hashsize, bswap, rounds>(lane_h, data[l], len[l] - blocks * 64, out[l]);
+      }
+      return;
+    }
+
+    // Pad each lane's last partial block exactly as finish() does
+    for (int l = 0; l < lanes; l++) {
+      uint64_t lenRemaining = len[l] - blocks * 64;
+      memset(lane_temp, (0x80+lenRemaining) & 255, sizeof(lane_temp));
+      memcpy(lane_temp, data[l], lenRemaining);
+      lane_temp[lenRemaining >> 3] |= (uint64_t)(lenRemaining << ((lenRemaining&7)*8));
+      for (int i = 0; i < 8; i++) {
+        temp[i][l] = lane_temp[i];
+      }
+    }
+
+    for (int i = 0; i < rounds; i++) {
+      weakfunc_lanes(h, temp, i & 1);
+    }
+
+    for (int i = 0, j = 8; i < 8; i++, j++) {
+      h[i] -= h[j];
+    }
+
+    if ( hashsize > 64 ) {
+      for (int i = 0; i < std::max((int)hashsize / 64, FINAL_ROUNDS); i++) weakfunc_lanes(h, temp, true);
+    }
+
+    for (int l = 0; l < lanes; l++) {
+      for (uint32_t i = 0, j = 0; i < std::min<uint32_t>(8, hashsize / 64); i++, j += 8) {
+        PUT_U64<bswap>(h[i][l], static_cast<uint8_t*>(out[l]), j);
+      }
+    }
+  }
+
+  template <int lanes, uint32_t hashsize, bool bswap, int rounds>
+  static void lanes_generic(const void* const* in, const size_t* len, const seed_t seed, void* const* out) {
+    lanes_kernel<lanes, hashsize, bswap, rounds>(in, len, seed, out);
+  }
+
+#ifdef RAIN_X86_DISPATCH
+  template <int lanes, uint32_t hashsize, bool bswap, int rounds>
+  __attribute__((target("avx2")))
+  static void lanes_avx2(const void* const* in, const size_t* len, const seed_t seed, void* const* out) {
+    lanes_kernel<lanes, hashsize, bswap, rounds>(in, len, seed, out);
+  }
+
+  template <int lanes, uint32_t hashsize, bool bswap, int rounds>
+  __attribute__((target("avx512f,avx512vl")))
+  static void lanes_avx512(const void* const* in, const size_t* len, const seed_t seed, void* const* out) {
+    lanes_kernel<lanes, hashsize, bswap, rounds>(in, len, seed, out);
+  }
+#endif
+
+  template <int lanes, uint32_t hashsize, bool bswap, int rounds>
+  static lanes_fn select_lanes() {
+#ifdef RAIN_X86_DISPATCH
+    switch (rainisa::active()) {
+      case rainisa::Isa::Avx512: return lanes_avx512<lanes, hashsize, bswap, rounds>;
+      case rainisa::Isa::Avx2:   return lanes_avx2<lanes, hashsize, bswap, rounds>;
+      default:                   break;
+    }
+#endif
+    return lanes_generic<lanes, hashsize, bswap, rounds>;
+  }
+
+  // Hash in[i] (len[i] bytes) into out[i] for each of the 4 lanes, all with the same seed
+  template <uint32_t hashsize, bool bswap, int rounds = ROUNDS>
+  static void rainstorm_x4(const void* const in[4], const size_t len[4], const seed_t seed, void* const out[4]) {
+    static const lanes_fn fn = select_lanes<4, hashsize, bswap, rounds>();
+    fn(in, len, seed, out);
+  }
+
+  template <uint32_t hashsize, bool bswap, int rounds = ROUNDS>
+  static void rainstorm_x8(const void* const in[8], const size_t len[8], const seed_t seed, void* const out[8]) {
+    static const lanes_fn fn = select_lanes<8, hashsize, bswap, rounds>();
+    fn(in, len, seed, out);
+  }
+
+  // Hash n messages, eight at a time with the leftovers finished one by one
+  template <uint32_t hashsize, bool bswap, int rounds = ROUNDS>
+  static void rainstorm_many(const void* const* in, const size_t* len, size_t n, const seed_t seed, void* const* out) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+      rainstorm_x8<hashsize, bswap, rounds>(in + i, len + i, seed, out + i);
+    }
+    if (i + 4 <= n) {
+      rainstorm_x4<hashsize, bswap, rounds>(in + i, len + i, seed, out + i);
+      i += 4;
+    }
+    for (; i < n; i++) {
+      rainstorm<hashsize, bswap, rounds>(in[i], len[i], seed, out[i]);
+    }
+  }
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+// CPU lists, thread pinning and NUMA node lookups for WorkPool
+// Linux only, read from /sys and move_pages(2) without libnuma. Elsewhere
+// nothing is pinned and every node lookup returns -1, which WorkPool takes
+// as "no preference".
+//
+// Memory follows first touch: a page lands on the node of the thread that
+// first writes it. Threads pinned to a node therefore get local per-thread
+// buffers for free, and the page cache holds file pages on the node that
+// read them in.
+
+#include <cstddef>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(__linux__) && !defined(__EMSCRIPTEN__)
+#define RAIN_NUMA_LINUX 1
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace rainnuma {
+  // CPU numbers a list may name, the most an affinity mask can hold
+#ifdef RAIN_NUMA_LINUX
+  constexpr unsigned long MAX_CPUS = CPU_SETSIZE;
+#else
+  constexpr unsigned long MAX_CPUS = 1024;
+#endif
+
+  // CPUs in a list like "0-7,16-23" or "3", in the order given
+  static inline std::vector<unsigned> parseCpuList(const std::string& list) {
+    std::vector<unsigned> cpus;
+    size_t at = 0;
+    while (at < list.size()) {
+      size_t comma = list.find(',', at);
+      std::string part = list.substr(at, comma == std::string::npos ? std::string::npos : comma - at);
+      at = comma == std::string::npos ? list.size() : comma + 1;
+      size_t dash = part.find('-');
+      try {
+        size_t used = 0;
+        unsigned long first = std::stoul(part.substr(0, dash), &used);
+        if (used != (dash == std::string::npos ? part.size() : dash)) {
+          throw std::invalid_argument(part);
+        }
+        unsigned long last = first;
+        if (dash != std::string::npos) {
+          last = std::stoul(part.substr(dash + 1), &used);
+          if (used != part.size() - dash - 1 || last < first) {
+            throw std::invalid_argument(part);
+          }
+        }
+        if (last >= MAX_CPUS) {
+          throw std::runtime_error("CPU " + std::to_string(last) + " in the CPU list is past the last possible CPU, " + std::to_string(MAX_CPUS - 1));
+        }
+        for (unsigned long cpu = first; cpu <= last; cpu++) {
+          cpus.push_back(static_cast<unsigned>(cpu));
+        }
+      } catch (const std::logic_error&) {
+        throw std::runtime_error("Invalid CPU list '" + list + "' (expected a list like 0-7,16-23)");
+      }
+    }
+    if (cpus.empty()) {
+      throw std::runtime_error("Invalid CPU list '" + list + "' (expected a list like 0-7,16-23)");
+    }
+    return cpus;
+  }
+
+  // CPUs this process may run on, in order, empty when that is unknown
+  static inline std::vector<unsigned> allowedCpus() {
+    std::vector<unsigned> cpus;
+#ifdef RAIN_NUMA_LINUX
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+      for (unsigned cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &set)) {
+          cpus.push_back(cpu);
+        }
+      }
+    }
+#endif
+    return cpus;
+  }
+
+  // Pin the calling thread to one CPU. False if the CPU does not exist or is not allowed.
+  static inline bool pinCurrentThread(unsigned cpu) {
+#ifdef RAIN_NUMA_LINUX
+    if (cpu >= CPU_SETSIZE) {
+      return false;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+    (void)cpu;
+    return false;
+#endif
+  }
+
+  // The node a CPU belongs to, -1 when there is no NUMA information
+  static inline int cpuNode(unsigned cpu) {
+#ifdef RAIN_NUMA_LINUX
+    for (int node = 0; ; node++) {
+      std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+      if (!in) {
+        // node numbers can have gaps, but are dense on all but exotic machines
+        return -1;
+      }
+      std::string list;
+      std::getline(in, list);
+      if (list.empty()) {
+        continue;                     // a memory-only node
+      }
+      for (unsigned member : parseCpuList(list)) {
+        if (member == cpu) {
+          return node;
+        }
+      }
+    }
+#else
+    (void)cpu;
+    return -1;
+#endif
+  }
+
+  // The node holding the page at addr, -1 if it is not resident or unknown
+  static inline int pageNode(const void* addr) {
+#if defined(RAIN_NUMA_LINUX) && defined(SYS_move_pages)
+    void* page = const_cast<void*>(addr);
+    int status = -1;
+    // with no target nodes move_pages only reports where each page is
+    if (syscall(SYS_move_pages, 0, 1UL, &page, nullptr, &status, 0) != 0 || status < 0) {
+      return -1;
+    }
+    return status;
+#else
+    (void)addr;
+    return -1;
+#endif
+  }
+}
@@ -0,0 +1,243 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "numa.h"
+
+// Fixed-size work-stealing thread pool
+// Each worker owns a deque: submit() deals tasks round-robin, a worker pops
+// from the front of its own deque and, when that runs dry, steals from the
+// back of the others. Tasks must not throw.
+//
+// Given a CPU list, worker i is pinned to cpus[i % cpus.size()] and the
+// workers are grouped by NUMA node. submit() can then name a node, which
+// deals the task among that node's workers only, and an idle worker steals
+// from its own node before it reaches across to another one.
+//
+// Any thread may submit. wait() covers every task in the pool, so a caller
+// sharing the pool with others waits on a TaskGroup of its own tasks instead.
+class WorkPool {
+  public:
+    explicit WorkPool(unsigned threads, const std::vector<unsigned>& cpus = {}) {
+      threads = std::max(1u, threads);
+      for (unsigned i = 0; i < threads; i++) {
+        queues.emplace_back(std::make_unique<Queue>());
+        int node = cpus.empty() ? -1 : rainnuma::cpuNode(cpus[i % cpus.size()]);
+        auto known = std::find(node_ids.begin(), node_ids.end(), node);
+        if (known == node_ids.end()) {
+          node_ids.push_back(node);
+          node_workers.emplace_back();
+          known = node_ids.end() - 1;
+        }
+        queues[i]->node = static_cast<unsigned>(known - node_ids.begin());
+        node_workers[queues[i]->node].push_back(i);
+      }
+      node_next.assign(node_ids.size(), 0);
+      for (unsigned i = 0; i < threads; i++) {
+        // steal order: own deque, then the rest of this node, then the other nodes
+        std::vector<unsigned>& order = queues[i]->steal_order;
+        order.push_back(i);
+        for (unsigned k = 1; k < threads; k++) {
+          unsigned j = (i + k) % threads;
+          if (queues[j]->node == queues[i]->node) {
+            order.push_back(j);
+          }
+        }
+        for (unsigned k = 1; k < threads; k++) {
+          unsigned j = (i + k) % threads;
+          if (queues[j]->node != queues[i]->node) {
+            order.push_back(j);
+          }
+        }
+      }
+      for (unsigned i = 0; i < threads; i++) {
+        if (cpus.empty()) {
+          workers.emplace_back([this, i] { run(i); });
+        } else {
+          unsigned cpu = cpus[i % cpus.size()];
+          workers.emplace_back([this, i, cpu] {
+            rainnuma::pinCurrentThread(cpu);
+            run(i);
+          });
+        }
+      }
+    }
+
+    ~WorkPool() {
+      wait();
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+      }
+      work_available.notify_all();
+      for (auto& worker : workers) {
+        worker.join();
+      }
+    }
+
+    WorkPool(const WorkPool&) = delete;
+    WorkPool& operator=(const WorkPool&) = delete;
+
+    // Queue a task, on one of the workers of node when it is one of this
+    // pool's nodes (a node number, as nodeAt() gives), else on any worker
+    void submit(std::function<void()> task, int node = -1) {
+      auto known = node < 0 ? node_ids.end() : std::find(node_ids.begin(), node_ids.end(), node);
+      {
+        // the counts go up before a worker can take the task and bring them down
+        std::lock_guard<std::mutex> lock(mutex);
+        unsigned target;
+        if (known != node_ids.end()) {
+          size_t k = known - node_ids.begin();
+          target = node_workers[k][node_next[k]++ % node_workers[k].size()];
+        } else {
+          target = static_cast<unsigned>(next_queue++ % queues.size());
+        }
+        Queue& queue = *queues[target];
+        {
+          std::lock_guard<std::mutex> queue_lock(queue.mutex);
+          queue.tasks.push_back(std::move(task));
+        }
+        queued++;
+        pending++;
+      }
+      work_available.notify_one();
+    }
+
+    // Block until every submitted task has run
+    void wait() {
+      std::unique_lock<std::mutex> lock(mutex);
+      all_done.wait(lock, [this] { return pending == 0; });
+    }
+
+    unsigned size() const {
+      return static_cast<unsigned>(workers.size());
+    }
+
+    // NUMA nodes the workers are pinned to, 1 when unpinned or on a single node
+    unsigned nodes() const {
+      return static_cast<unsigned>(node_ids.size());
+    }
+
+    // Node number of the i-th of nodes(), -1 when unknown
+    int nodeAt(unsigned i) const {
+      return node_ids[i];
+    }
+
+  private:
+    struct Queue {
+      std::mutex mutex;
+      std::deque<std::function<void()>> tasks;
+      unsigned node = 0;                    // index into node_ids
+      std::vector<unsigned> steal_order;
+    };
+
+    bool take(unsigned self, std::function<void()>& task) {
+      const std::vector<unsigned>& order = queues[self]->steal_order;
+      for (size_t i = 0; i < order.size(); i++) {
+        Queue& queue = *queues[order[i]];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) {
+          continue;
+        }
+        if (i == 0) {
+          task = std::move(queue.tasks.front());
+          queue.tasks.pop_front();
+        } else {
+          task = std::move(queue.tasks.back());
+          queue.tasks.pop_back();
+        }
+        return true;
+      }
+      return false;
+    }
+
+    void run(unsigned self) {
+      std::function<void()> task;
+      while (true) {
+        if (take(self, task)) {
+          {
+            std::lock_guard<std::mutex> lock(mutex);
+            queued--;
+          }
+          task();
+          task = nullptr;
+          std::lock_guard<std::mutex> lock(mutex);
+          if (--pending == 0) {
+            all_done.notify_all();
+          }
+          continue;
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        work_available.wait(lock, [this] { return queued > 0 || stopping; });
+        if (stopping && queued == 0) {
+          return;
+        }
+      }
+    }
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    size_t next_queue = 0;                            // round-robin position, under mutex
+    std::vector<int> node_ids;                        // distinct nodes, in order of first worker
+    std::vector<std::vector<unsigned>> node_workers;  // workers on each of node_ids
+    std::vector<size_t> node_next;                    // round-robin position within each node, under mutex
+
+    std::mutex mutex;
+    std::condition_variable work_available;
+    std::condition_variable all_done;
+    size_t queued = 0;              // tasks sitting in some deque
+    size_t pending = 0;             // tasks submitted but not yet finished
+    bool stopping = false;
+};
+
+// Tasks that one caller submits and waits for together, so callers sharing a
+// pool (--serve connections) only wait for their own work. Without a pool,
+// run() runs the task at once.
+class TaskGroup {
+  public:
+    explicit TaskGroup(WorkPool* pool) : pool(pool) {}
+
+    ~TaskGroup() {
+      wait();
+    }
+
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    void run(std::function<void()> task, int node = -1) {
+      if (!pool) {
+        task();
+        return;
+      }
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending++;
+      }
+      pool->submit([this, task = std::move(task)] {
+        task();
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--pending == 0) {
+          all_done.notify_all();
+        }
+      }, node);
+    }
+
+    // Block until every task run() was given has finished
+    void wait() {
+      std::unique_lock<std::mutex> lock(mutex);
+      all_done.wait(lock, [this] { return pending == 0; });
+    }
+
+  private:
+    WorkPool* pool;
+    std::mutex mutex;
+    std::condition_variable all_done;
+    size_t pending = 0;
+};
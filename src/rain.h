@@ -0,0 +1,82 @@
+#ifndef RAIN_H
+#define RAIN_H
+
+/*
+  C ABI for the Rain hashes (librain)
+  One-shot functions carry the names of the WebAssembly exports. Streaming
+  hashing uses a caller-owned RainState, so there is nothing to allocate or
+  free. Digests are the canonical ones, the same on every platform.
+
+  The caller allocates RainState, so its size is part of the ABI:
+  sizeof(RainState) is fixed for RAIN_ABI_VERSION 1, and the 272 bytes of
+  opaque are the headroom every streaming state has to fit in. Any change to
+  the size bumps RAIN_ABI_VERSION, and with it the librain.so.N soname.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RAIN_ABI_VERSION 1
+
+#if defined(_WIN32) && defined(RAIN_BUILDING_LIBRARY)
+#define RAIN_API __declspec(dllexport)
+#elif defined(__GNUC__)
+#define RAIN_API __attribute__((visibility("default")))
+#else
+#define RAIN_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum {
+  RAIN_RAINBOW   = 0,
+  RAIN_RAINSTORM = 1
+};
+
+typedef struct RainState {
+  uint32_t algorithm;
+  uint32_t bits;
+  uint64_t opaque[34];
+} RainState;
+
+RAIN_API int rainAbiVersion(void);
+
+RAIN_API void rainbowHash64(const void* in, size_t len, uint64_t seed, void* out);
+RAIN_API void rainbowHash128(const void* in, size_t len, uint64_t seed, void* out);
+RAIN_API void rainbowHash256(const void* in, size_t len, uint64_t seed, void* out);
+
+RAIN_API void rainstormHash64(const void* in, size_t len, uint64_t seed, void* out);
+RAIN_API void rainstormHash128(const void* in, size_t len, uint64_t seed, void* out);
+RAIN_API void rainstormHash256(const void* in, size_t len, uint64_t seed, void* out);
+RAIN_API void rainstormHash512(const void* in, size_t len, uint64_t seed, void* out);
+
+/*
+  Start hashing total_len bytes with algorithm RAIN_RAINBOW (64, 128 or 256
+  bits) or RAIN_RAINSTORM (64, 128, 256 or 512 bits). The digest matches the
+  one-shot hash of all the bytes passed to rainUpdate, which must add up to
+  total_len. Returns 0, or -1 for an unsupported algorithm or size, which
+  leaves the state unusable.
+*/
+RAIN_API int rainInit(RainState* state, uint32_t algorithm, uint32_t bits, uint64_t seed, uint64_t total_len);
+
+/*
+  Absorb len bytes; chunks may be any size. Returns 0, or -1 without absorbing
+  anything if the state is not initialized, is already finalized, or the
+  bytes would run past total_len.
+*/
+RAIN_API int rainUpdate(RainState* state, const void* data, size_t len);
+
+/*
+  Write bits / 8 bytes of digest to out. Returns 0, or -1 without writing if
+  the state is not initialized or already finalized, or rainUpdate was given
+  fewer than total_len bytes.
+*/
+RAIN_API int rainFinal(RainState* state, void* out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
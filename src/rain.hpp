@@ -0,0 +1,21 @@
+#pragma once
+
+// Header-only Rain hashes for embedding
+// Everything here is inline (static or constexpr templates), so the hash can be
+// inlined into the caller's loops and optimized with it. Only the standard
+// library is used: no iostream, no cxxopts, no threads.
+//
+//   #include "rain.hpp"
+//   rainbow::rainbow<64, bswap>(data, len, seed, out);
+//   auto state = rainstorm::HashState<512>::initialize(seed, total_len);
+//
+// Install with `make install-lib`, which copies these headers to
+// $(PREFIX)/include/rain. C callers, and anyone who wants a stable ABI rather
+// than inlining, use rain.h and librain instead.
+
+#include "rainbow.cpp"
+#include "rainstorm.cpp"
+#include "multibuffer.h"
+#include "chunker.h"
+#include "xof.h"
+#include "keystream.h"
@@ -25,6 +25,11 @@
 #include <cstdlib>
 #include <cstring>
 #include <cstdio>
+#include <algorithm>
+#include <array>
+#include <string>
+#include <string_view>
+#include <type_traits>
 
 #ifdef __EMSCRIPTEN__
 #include <emscripten.h>
@@ -47,7 +52,7 @@ namespace rainbow {
   static constexpr uint64_t V        = UINT64_C(  2849285319520710901);
   static constexpr uint64_t W        = UINT64_C(  2366157163652459183);
 
-  static inline void mixA(uint64_t* s) {
+  static constexpr inline void mixA(uint64_t* s) {
     uint64_t a = s[0], b = s[1], c = s[2], d = s[3];
 
     a *= P;
@@ -73,7 +78,7 @@ namespace rainbow {
     s[0] = a; s[1] = b; s[2] = c; s[3] = d;
   }
 
-  static inline void mixB(uint64_t* s, uint64_t iv) {
+  static constexpr inline void mixB(uint64_t* s, uint64_t iv) {
     uint64_t a = s[1], b = s[2];
 
     a *= V;
@@ -89,27 +94,146 @@ namespace rainbow {
     s[1] = a; s[2] = b; 
   }
 
+  // Absorb one 128-bit input chunk, already loaded as two words
+  static constexpr inline void absorbWords(uint64_t* h, uint64_t g0, uint64_t g1) {
+    h[0] -= g0;
+    h[1] += g0;
+
+    h[2] += g1;
+    h[3] -= g1;
+  }
+
+  // Absorb one 128-bit input chunk
+  template <bool bswap>
+  static inline void absorb(uint64_t* h, const uint8_t* data) {
+    absorbWords(h, GET_U64<bswap>(data, 0), GET_U64<bswap>(data, 8));
+  }
+
+  // Absorb the last len < 16 bytes and run the final mixes
+  // Byte may be char so the constexpr paths can hash string literals
+  template <typename Byte>
+  static constexpr inline void tail(uint64_t* h, const Byte* data, size_t len, const seed_t seed) {
+    mixB(h, seed);
+
+    switch (len) {
+      case 15:
+	h[0] += static_cast<uint64_t>(static_cast<uint8_t>(data[14])) << 56;
+	[[fallthrough]];
+
+      case 14:
+	h[1] += static_cast<uint64_t>(static_cast<uint8_t>(data[13])) << 48;
+	[[fallthrough]];
+
+      case 13:
+	h[2] += static_cast<uint64_t>(static_cast<uint8_t>(data[12])) << 40;
+	[[fallthrough]];
+
+      case 12:
+	h[3] += static_cast<uint64_t>(static_cast<uint8_t>(data[11])) << 32;
+	[[fallthrough]];
+
+      case 11:
+	h[0] += static_cast<uint64_t>(static_cast<uint8_t>(data[10])) << 24;
+	[[fallthrough]];
+
+      case 10:
+	h[1] += static_cast<uint64_t>(static_cast<uint8_t>(data[9])) << 16;
+	[[fallthrough]];
+
+      case 9:
+	h[2] += static_cast<uint64_t>(static_cast<uint8_t>(data[8])) << 8;
+	[[fallthrough]];
+
+      case 8:
+	h[3] += static_cast<uint8_t>(data[7]);
+	[[fallthrough]];
+
+      case 7:
+	h[0] += static_cast<uint64_t>(static_cast<uint8_t>(data[6])) << 48;
+	[[fallthrough]];
+
+      case 6:
+	h[1] += static_cast<uint64_t>(static_cast<uint8_t>(data[5])) << 40;
+	[[fallthrough]];
+
+      case 5:
+	h[2] += static_cast<uint64_t>(static_cast<uint8_t>(data[4])) << 32;
+	[[fallthrough]];
+
+      case 4:
+	h[3] += static_cast<uint64_t>(static_cast<uint8_t>(data[3])) << 24;
+	[[fallthrough]];
+
+      case 3:
+	h[0] += static_cast<uint64_t>(static_cast<uint8_t>(data[2])) << 16;
+	[[fallthrough]];
+
+      case 2:
+	h[1] += static_cast<uint64_t>(static_cast<uint8_t>(data[1])) << 8;
+	[[fallthrough]];
+
+      case 1:
+	h[2] += static_cast<uint8_t>(data[0]);
+    }
+
+    mixA(h);
+    mixB(h, seed);
+    mixA(h);
+  }
+
+  // Squeeze hashsize bits of output from the finished state, as words
+  template <uint32_t hashsize>
+  static constexpr inline void squeezeWords(uint64_t* h, const seed_t seed, uint64_t* words) {
+    words[0] = 0 - h[2] - h[3];
+    if (hashsize == 128) {
+      mixA(h);
+      words[1] = 0 - h[3] - h[2];
+    } else if ( hashsize == 256) {
+      mixA(h);
+      words[1] = 0 - h[3] - h[2];
+      mixA(h);
+      mixB(h, seed);
+      mixA(h);
+      words[2] = 0 - h[3] - h[2];
+      mixA(h);
+      words[3] = 0 - h[3] - h[2];
+    }
+  }
+
+  // Squeeze hashsize bits of output from the finished state
+  template <uint32_t hashsize, bool bswap>
+  static inline void squeeze(uint64_t* h, const seed_t seed, void* out) {
+    uint64_t words[4] = {0};
+    squeezeWords<hashsize>(h, seed, words);
+    for (uint32_t i = 0; i < hashsize / 64; i++) {
+      PUT_U64<bswap>(words[i], static_cast<uint8_t *>(out), i * 8);
+    }
+  }
+
   // streaming mode affordances
-  struct HashState : IHashState {
+  // hashsize and byte order are template parameters, so update and finalize
+  // inline fully with no dispatch; the CLI wraps this in ErasedHashState
+  template <uint32_t hashsize, bool bswap = ::bswap>
+  struct HashState {
     uint64_t  h[4];
     seed_t    seed;
     size_t    len;                  // length processed so far
-    uint32_t  hashsize;
+    size_t    total_len;            // length promised to initialize
+    uint8_t   buffer[16];           // partial block carried between updates
+    size_t    buffered = 0;
     bool      inner = 0;
-    bool      final_block = false;
     bool      finalized = false;
 
     // Initialize the state with known length
-    static HashState initialize(const seed_t seed, size_t olen, uint32_t hashsize) {
+    static HashState initialize(const seed_t seed, size_t olen) {
       HashState state;
       state.h[0] = seed + olen + 1;
       state.h[1] = seed + olen + 3;
       state.h[2] = seed + olen + 5;
       state.h[3] = seed + olen + 7;
       state.len = 0;  // initialize length counter
+      state.total_len = olen;
       state.seed = seed;
-      state.hashsize = hashsize;
-      //std::cout << "Len: " << olen << std::endl;
       return state;
     }
 
@@ -122,8 +246,8 @@ namespace rainbow {
       // the result will be different
       // This is not ideal, and may be considered a design flaw
       // For now the way we work around that is, if we read from stdin
-      // we do not use streaming mode. We only use streaming mode when we
-      // are reading from a known file (and have the length)
+      // we buffer small inputs and spool large ones to a temporary file,
+      // so the length is always known before we initialize the state
       static HashState initialize(const seed_t seed) {
         HashState state;
         h[0] = seed + 1002;   // 1001 + 1;
@@ -135,182 +259,148 @@ namespace rainbow {
       }
     */
 
-    // Update the state with a new chunk of data
+    // Absorb one full 128-bit block
+    inline void block(const uint8_t* data) {
+      absorb<bswap>(h, data);
+
+      if ( inner ) {
+        mixB(h, seed);
+      } else {
+        mixA(h);
+      }
+      inner ^= 1;
+    }
+
+    // Update the state with a new chunk of data, of any length
+    // Full blocks are absorbed as they arrive, and up to 15 trailing bytes are
+    // held back until the next update or finalize
     void update(const uint8_t* chunk, size_t chunk_len) {
-      // update state based on chunk
-      bool last_block = chunk_len < CHUNK_SIZE;
-      if ( final_block ) {
-        // throw
+      if ( finalized ) {
+        return;
       }
       len += chunk_len;
 
-      //printf("h: %016llx %016llx %016llx %016llx\n", h[0], h[1], h[2], h[3]);
-
-      while (chunk_len >= 16) {
-        uint64_t g =  GET_U64<bswap>(chunk, 0);
-
-        h[0] -= g;
-        h[1] += g;
-
-        chunk += 8;
-
-        g =  GET_U64<bswap>(chunk, 0);
-
-        h[2] += g;
-        h[3] -= g;
-
-        if ( inner ) {
-          mixB(h, seed);
-        } else {
-          mixA(h);
+      if ( buffered ) {
+        size_t take = std::min(chunk_len, sizeof(buffer) - buffered);
+        memcpy(buffer + buffered, chunk, take);
+        buffered += take;
+        chunk += take;
+        chunk_len -= take;
+        if ( buffered < sizeof(buffer) ) {
+          return;
         }
-        inner ^= 1;
+        block(buffer);
+        buffered = 0;
+      }
 
-        chunk += 8;
+      while (chunk_len >= 16) {
+        block(chunk);
+        chunk += 16;
         chunk_len -= 16;
       }
 
-      //printf("h: %016llx %016llx %016llx %016llx\n", h[0], h[1], h[2], h[3]);
-      
-      if ( last_block ) {
-        final_block = true;
-        mixB(h, seed);
-
-        switch (chunk_len) {
-	   case 15:
-	     h[0] += static_cast<uint64_t>(chunk[14]) << 56;
-	     [[fallthrough]];
-
-	   case 14:
-	     h[1] += static_cast<uint64_t>(chunk[13]) << 48;
-	     [[fallthrough]];
-
-	   case 13:
-	     h[2] += static_cast<uint64_t>(chunk[12]) << 40;
-	     [[fallthrough]];
-
-	   case 12:
-	     h[3] += static_cast<uint64_t>(chunk[11]) << 32;
-	     [[fallthrough]];
-
-	   case 11:
-	     h[0] += static_cast<uint64_t>(chunk[10]) << 24;
-	     [[fallthrough]];
-
-	   case 10:
-	     h[1] += static_cast<uint64_t>(chunk[9]) <<  16;
-	     [[fallthrough]];
-
-	   case 9:
-	     h[2] += static_cast<uint64_t>(chunk[8]) << 8;
-	     [[fallthrough]];
-
-	   case 8:
-	     h[3] += chunk[7];
-	     [[fallthrough]];
-
-	   case 7:
-	     h[0] += static_cast<uint64_t>(chunk[6]) << 48;
-	     [[fallthrough]];
-
-	   case 6:
-	     h[1] += static_cast<uint64_t>(chunk[5]) << 40;
-	     [[fallthrough]];
-
-	   case 5:
-	     h[2] += static_cast<uint64_t>(chunk[4]) << 32;
-	     [[fallthrough]];
-
-	   case 4:
-	     h[3] += static_cast<uint64_t>(chunk[3]) << 24;
-	     [[fallthrough]];
-
-	   case 3:
-	     h[0] += static_cast<uint64_t>(chunk[2]) << 16;
-	     [[fallthrough]];
-
-	   case 2:
-	     h[1] += static_cast<uint64_t>(chunk[1]) <<  8;
-	     [[fallthrough]];
-
-	   case 1:
-	     h[2] += chunk[0];
-        }
-
-        mixA(h);
-        mixB(h, seed);
-        mixA(h);
-
-        //printf("h: %016llx %016llx %016llx %016llx\n", h[0], h[1], h[2], h[3]);
-      }
+      memcpy(buffer, chunk, chunk_len);
+      buffered = chunk_len;
     }
 
     // Finalize the hash and return the result
-    void finalize(void* out) {
+    // Returns false, writing nothing, if the updates did not add up to the
+    // length given to initialize or the state was already finalized
+    bool finalize(void* out) {
       // finalize hash
-      if ( finalized ) {
-        return;
+      if ( finalized || len != total_len ) {
+        return false;
       } 
-      
-      uint64_t g = 0;
-      g -= h[2];
-      g -= h[3];
 
-      PUT_U64<bswap>(g, static_cast<uint8_t *>(out), 0);
-      if (this->hashsize == 128) {
-        mixA(h);
-        g = 0;
-        g -= h[3];
-        g -= h[2];
-        PUT_U64<bswap>(g, static_cast<uint8_t *>(out), 8);
-      } else if ( this->hashsize == 256) {
-        mixA(h);
-        g = 0;
-        g -= h[3];
-        g -= h[2];
-        PUT_U64<bswap>(g, static_cast<uint8_t *>(out), 8);
-        mixA(h);
+      tail(h, buffer, buffered, seed);
+      squeeze<hashsize, bswap>(h, seed, out);
+      finalized = true;
+      return true;
+    }
+  };
+
+  // Absorb the full blocks of data, pad the rest and write the digest
+  // Split out of rainbow() so Keyed can start from a prepared state
+  template <uint32_t hashsize, bool bswap>
+  static inline void finish(uint64_t* h, const uint8_t* data, size_t len, const seed_t seed, void* out) {
+    bool inner = 0;
+
+    while (len >= 16) {
+      absorb<bswap>(h, data);
+
+      if ( inner ) {
         mixB(h, seed);
+      } else {
         mixA(h);
-        g = 0;
-        g -= h[3];
-        g -= h[2];
-        PUT_U64<bswap>(g, static_cast<uint8_t *>(out), 16);
-        mixA(h);
-        g = 0;
-        g -= h[3];
-        g -= h[2];
-        PUT_U64<bswap>(g, static_cast<uint8_t *>(out), 24);
       }
+      inner ^= 1;
 
-      finalized = true;
+      data += 16;
+      len  -= 16;
     }
-  };
+
+    tail(h, data, len, seed);
+    squeeze<hashsize, bswap>(h, seed, out);
+  }
 
   // one big func mode (memory inefficient, but simple call)
   template <uint32_t hashsize, bool bswap>
   static void rainbow(const void* in, const size_t olen, const seed_t seed, void* out) {
-    const uint8_t * data = static_cast<const uint8_t *>(in);
     uint64_t h[4] = {seed + olen + 1, seed + olen + 3, seed + olen + 5, seed + olen + 7};
-    size_t len = olen;
-    uint64_t g = 0;
-    bool inner = 0;
-
-    //std::cout << "Len: " << olen << std::endl;
-    //printf("h: %016llx %016llx %016llx %016llx\n", h[0], h[1], h[2], h[3]);
+    finish<hashsize, bswap>(h, static_cast<const uint8_t *>(in), olen, seed, out);
+  }
 
-    while (len >= 16) {
-      g =  GET_U64<bswap>(data, 0);
+  // A hasher bound to one seed, for workloads that hash many small messages
+  // with a few fixed seeds. The seeded part of the initial state is computed
+  // once, so each hash only adds the length in. A Keyed is a small trivially
+  // copyable value: give each thread its own copy. Digests are the ones
+  // rainbow<hashsize, bswap> gives with the same seed.
+  //
+  //   rainbow::Keyed<256> tenant(seed);
+  //   tenant.hash(data, len, out);
+  template <uint32_t hashsize = 256, bool bswap = ::bswap>
+  struct Keyed {
+    static_assert(hashsize == 64 || hashsize == 128 || hashsize == 256, "Rainbow digests are 64, 128 or 256 bits");
+
+    uint64_t iv[4];
+    seed_t   seed;
+
+    explicit Keyed(const seed_t seed = 0) : iv{seed + 1, seed + 3, seed + 5, seed + 7}, seed(seed) {}
+
+    void hash(const void* in, const size_t len, void* out) const {
+      uint64_t h[4] = {iv[0] + len, iv[1] + len, iv[2] + len, iv[3] + len};
+      finish<hashsize, bswap>(h, static_cast<const uint8_t *>(in), len, seed, out);
+    }
 
-      h[0] -= g;
-      h[1] += g;
+    // Streaming state for a message of total_len bytes
+    HashState<hashsize, bswap> stream(const size_t total_len) const {
+      return HashState<hashsize, bswap>::initialize(seed, total_len);
+    }
+  };
 
-      data += 8;
+  // Fixed-size keys
+  // Integer IDs, UUIDs and packed composite keys have a length known at
+  // compile time, so the block loop unrolls and the tail switch folds away.
+  // Bytes are read little-endian one at a time (compilers merge them into
+  // plain loads), which also makes all of this usable in constant expressions.
+  // Results are the canonical digests: the words rainbow<hashsize, ::bswap>
+  // writes, as native integers.
+  template <typename Byte>
+  static constexpr inline uint64_t loadLE(const Byte* data) {
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; i--) {
+      value = (value << 8) | static_cast<uint8_t>(data[i]);
+    }
+    return value;
+  }
 
-      g =  GET_U64<bswap>(data, 0);
+  template <uint32_t hashsize, typename Byte>
+  static constexpr inline std::array<uint64_t, hashsize / 64> digestWords(const Byte* data, size_t len, const seed_t seed) {
+    uint64_t h[4] = {seed + len + 1, seed + len + 3, seed + len + 5, seed + len + 7};
+    bool inner = 0;
 
-      h[2] += g;
-      h[3] -= g;
+    while (len >= 16) {
+      absorbWords(h, loadLE(data), loadLE(data + 8));
 
       if ( inner ) {
         mixB(h, seed);
@@ -319,110 +409,177 @@ namespace rainbow {
       }
       inner ^= 1;
 
-      data += 8;
+      data += 16;
       len  -= 16;
     }
 
-    //printf("h: %016llx %016llx %016llx %016llx\n", h[0], h[1], h[2], h[3]);
-
-    mixB(h, seed);
-
-    switch (len) {
-      case 15:
-	h[0] += static_cast<uint64_t>(data[14]) << 56;
-	[[fallthrough]];
-
-      case 14:
-	h[1] += static_cast<uint64_t>(data[13]) << 48;
-	[[fallthrough]];
-
-      case 13:
-	h[2] += static_cast<uint64_t>(data[12]) << 40;
-	[[fallthrough]];
+    tail(h, data, len, seed);
+    std::array<uint64_t, hashsize / 64> words{};
+    uint64_t squeezed[4] = {0, 0, 0, 0};
+    squeezeWords<hashsize>(h, seed, squeezed);
+    for (size_t i = 0; i < words.size(); i++) {
+      words[i] = squeezed[i];
+    }
+    return words;
+  }
 
-      case 12:
-	h[3] += static_cast<uint64_t>(data[11]) << 32;
-	[[fallthrough]];
+  // hashsize bits of the digest of a key_len-byte key, e.g. a UUID or struct
+  template <uint32_t hashsize, size_t key_len>
+  static inline void rainbow_fixed(const void* key, const seed_t seed, void* out) {
+    auto words = digestWords<hashsize>(static_cast<const uint8_t *>(key), key_len, seed);
+    for (size_t i = 0; i < words.size(); i++) {
+      PUT_U64<::bswap>(words[i], static_cast<uint8_t *>(out), i * 8);
+    }
+  }
 
-      case 11:
-	h[0] += static_cast<uint64_t>(data[10]) << 24;
-	[[fallthrough]];
+  // 64-bit digest of a key_len-byte key
+  template <size_t key_len>
+  static inline uint64_t hash_fixed(const void* key, const seed_t seed = 0) {
+    return digestWords<64>(static_cast<const uint8_t *>(key), key_len, seed)[0];
+  }
 
-      case 10:
-	h[1] += static_cast<uint64_t>(data[9]) << 16;
-	[[fallthrough]];
+  // 64-bit digest of an integer, hashed as its 8 little-endian bytes
+  template <uint32_t hashsize = 64>
+  static constexpr inline uint64_t hash(uint64_t key, const seed_t seed = 0) {
+    static_assert(hashsize == 64, "integer keys have 64-bit digests, use rainbow_fixed for wider ones");
+    const uint8_t bytes[8] = {
+      static_cast<uint8_t>(key),       static_cast<uint8_t>(key >> 8),
+      static_cast<uint8_t>(key >> 16), static_cast<uint8_t>(key >> 24),
+      static_cast<uint8_t>(key >> 32), static_cast<uint8_t>(key >> 40),
+      static_cast<uint8_t>(key >> 48), static_cast<uint8_t>(key >> 56)
+    };
+    return digestWords<64>(bytes, 8, seed)[0];
+  }
 
-      case 9:
-	h[2] += static_cast<uint64_t>(data[8]) << 8;
-	[[fallthrough]];
+  // 64-bit digest of a string, in constant expressions too:
+  //   constexpr uint64_t id = rainbow::hash(std::string_view("session-start"));
+  static constexpr inline uint64_t hash(std::string_view text, const seed_t seed = 0) {
+    return digestWords<64>(text.data(), text.size(), seed)[0];
+  }
 
-      case 8:
-	h[3] += data[7];
-	[[fallthrough]];
+  // std::hash-compatible functor, e.g. std::unordered_map<Key, V, rainbow::Hash<Key>>
+  // Keys are hashed by their object representation, so they must have no
+  // padding bytes; strings hash their characters.
+  template <typename Key>
+  struct Hash {
+    static_assert(std::has_unique_object_representations_v<Key>, "keys must not contain padding, which would be hashed");
+    seed_t seed = 0;
 
-      case 7:
-	h[0] += static_cast<uint64_t>(data[6]) << 48;
-	[[fallthrough]];
+    size_t operator()(const Key& key) const noexcept {
+      return static_cast<size_t>(hash_fixed<sizeof(Key)>(&key, seed));
+    }
+  };
 
-      case 6:
-	h[1] += static_cast<uint64_t>(data[5]) << 40;
-	[[fallthrough]];
+  template <>
+  struct Hash<std::string_view> {
+    seed_t seed = 0;
 
-      case 5:
-	h[2] += static_cast<uint64_t>(data[4]) << 32;
-	[[fallthrough]];
+    size_t operator()(std::string_view key) const noexcept {
+      return static_cast<size_t>(hash(key, seed));
+    }
+  };
 
-      case 4:
-	h[3] += static_cast<uint64_t>(data[3]) << 24;
-	[[fallthrough]];
+  template <>
+  struct Hash<std::string> : Hash<std::string_view> {};
+
+  // Batch mode for short keys (hash table workloads)
+  // lanes independent keys go through each step together, so their multiply
+  // chains overlap instead of each key waiting on its own latency. With a
+  // fixed_len the loop and the tail switch are resolved at compile time.
+  template <size_t lanes, bool bswap, size_t fixed_len = 0>
+  static inline void rainbow64_lanes(const void* const* keys, const size_t* lens, const seed_t seed, uint64_t* out) {
+    uint64_t h[lanes][4];
+    const uint8_t* data[lanes];
+    size_t len[lanes];
+    size_t blocks = SIZE_MAX;
+
+    for (size_t l = 0; l < lanes; l++) {
+      data[l] = static_cast<const uint8_t *>(keys[l]);
+      len[l] = fixed_len ? fixed_len : lens[l];
+      h[l][0] = seed + len[l] + 1;
+      h[l][1] = seed + len[l] + 3;
+      h[l][2] = seed + len[l] + 5;
+      h[l][3] = seed + len[l] + 7;
+      blocks = std::min(blocks, len[l] / 16);
+    }
 
-      case 3:
-	h[0] += static_cast<uint64_t>(data[2]) << 16;
-	[[fallthrough]];
+    bool inner = 0;
+    for (size_t b = 0; b < blocks; b++) {
+      for (size_t l = 0; l < lanes; l++) {
+        absorb<bswap>(h[l], data[l]);
+        if ( inner ) {
+          mixB(h[l], seed);
+        } else {
+          mixA(h[l]);
+        }
+        data[l] += 16;
+        len[l] -= 16;
+      }
+      inner ^= 1;
+    }
 
-      case 2:
-	h[1] += static_cast<uint64_t>(data[1]) << 8;
-	[[fallthrough]];
+    for (size_t l = 0; l < lanes; l++) {
+      // keys longer than the shortest one in the group carry on alone
+      bool lane_inner = inner;
+      while (len[l] >= 16) {
+        absorb<bswap>(h[l], data[l]);
+        if ( lane_inner ) {
+          mixB(h[l], seed);
+        } else {
+          mixA(h[l]);
+        }
+        lane_inner ^= 1;
+        data[l] += 16;
+        len[l] -= 16;
+      }
+    }
 
-      case 1:
-	h[2] += data[0];
+    for (size_t l = 0; l < lanes; l++) {
+      tail(h[l], data[l], len[l], seed);
     }
 
-    mixA(h);
-    mixB(h, seed);
-    mixA(h);
+    for (size_t l = 0; l < lanes; l++) {
+      out[l] = 0 - h[l][2] - h[l][3];
+    }
+  }
 
-    //printf("h: %016llx %016llx %016llx %016llx\n", h[0], h[1], h[2], h[3]);
+  constexpr size_t BATCH_LANES = 4;
 
-    g = 0;
-    g -= h[2];
-    g -= h[3];
+  // 64-bit hashes of n keys that all have length key_len, known at compile time
+  template <size_t key_len, bool bswap = ::bswap>
+  static void rainbow64_batch_fixed(const void* const* keys, const seed_t seed, uint64_t* out, size_t n) {
+    size_t i = 0;
+    for (; i + BATCH_LANES <= n; i += BATCH_LANES) {
+      rainbow64_lanes<BATCH_LANES, bswap, key_len>(keys + i, nullptr, seed, out + i);
+    }
+    for (; i < n; i++) {
+      rainbow64_lanes<1, bswap, key_len>(keys + i, nullptr, seed, out + i);
+    }
+  }
 
-    PUT_U64<bswap>(g, static_cast<uint8_t *>(out), 0);
-    if (hashsize == 128) {
-      mixA(h);
-      g = 0;
-      g -= h[3];
-      g -= h[2];
-      PUT_U64<bswap>(g, static_cast<uint8_t *>(out), 8);
-    } else if ( hashsize == 256) {
-      mixA(h);
-      g = 0;
-      g -= h[3];
-      g -= h[2];
-      PUT_U64<bswap>(g, static_cast<uint8_t *>(out), 8);
-      mixA(h);
-      mixB(h, seed);
-      mixA(h);
-      g = 0;
-      g -= h[3];
-      g -= h[2];
-      PUT_U64<bswap>(g, static_cast<uint8_t *>(out), 16);
-      mixA(h);
-      g = 0;
-      g -= h[3];
-      g -= h[2];
-      PUT_U64<bswap>(g, static_cast<uint8_t *>(out), 24);
+  // 64-bit hashes of n keys. out[i] is the value rainbow<64, bswap> writes for
+  // keys[i], as a native integer. Groups of 8, 16 or 32-byte keys take the
+  // fixed-length kernels.
+  template <bool bswap = ::bswap>
+  static void rainbow64_batch(const void* const* keys, const size_t* lens, const seed_t seed, uint64_t* out, size_t n) {
+    size_t i = 0;
+    for (; i + BATCH_LANES <= n; i += BATCH_LANES) {
+      bool same = true;
+      for (size_t l = 1; l < BATCH_LANES; l++) {
+        same &= lens[i + l] == lens[i];
+      }
+      if (same && lens[i] == 8) {
+        rainbow64_lanes<BATCH_LANES, bswap, 8>(keys + i, nullptr, seed, out + i);
+      } else if (same && lens[i] == 16) {
+        rainbow64_lanes<BATCH_LANES, bswap, 16>(keys + i, nullptr, seed, out + i);
+      } else if (same && lens[i] == 32) {
+        rainbow64_lanes<BATCH_LANES, bswap, 32>(keys + i, nullptr, seed, out + i);
+      } else {
+        rainbow64_lanes<BATCH_LANES, bswap>(keys + i, lens + i, seed, out + i);
+      }
+    }
+    for (; i < n; i++) {
+      rainbow64_lanes<1, bswap>(keys + i, lens + i, seed, out + i);
     }
   }
 }
@@ -441,5 +598,39 @@ extern "C" {
   KEEPALIVE void rainbowHash256(const void* in, const size_t len, const seed_t seed, void* out) {
     rainbow::rainbow<256, false>(in, len, seed, out);
   }
+
+  // Streaming: init, then fill rainbowStreamBuffer with up to
+  // WASM_STREAM_BUFFER bytes and call update as often as needed, then final,
+  // which also frees the stream. total_len must be the length of all chunks.
+  KEEPALIVE void* rainbowStreamInit(const uint32_t hashsize, const seed_t seed, const uint64_t total_len) {
+    switch (hashsize) {
+      case 64:
+        return new WasmStream(new ErasedHashState<rainbow::HashState<64, false>>(rainbow::HashState<64, false>::initialize(seed, total_len)));
+      case 128:
+        return new WasmStream(new ErasedHashState<rainbow::HashState<128, false>>(rainbow::HashState<128, false>::initialize(seed, total_len)));
+      case 256:
+        return new WasmStream(new ErasedHashState<rainbow::HashState<256, false>>(rainbow::HashState<256, false>::initialize(seed, total_len)));
+    }
+    return nullptr;
+  }
+
+  KEEPALIVE uint8_t* rainbowStreamBuffer(void* stream) {
+    return static_cast<WasmStream*>(stream)->input;
+  }
+
+  KEEPALIVE size_t rainbowStreamBufferSize() {
+    return WASM_STREAM_BUFFER;
+  }
+
+  KEEPALIVE void rainbowStreamUpdate(void* stream, const size_t len) {
+    WasmStream* s = static_cast<WasmStream*>(stream);
+    s->state->update(s->input, std::min(len, WASM_STREAM_BUFFER));
+  }
+
+  KEEPALIVE void rainbowStreamFinal(void* stream, void* out) {
+    WasmStream* s = static_cast<WasmStream*>(stream);
+    s->state->finalize(out);
+    delete s;
+  }
 }
 #endif
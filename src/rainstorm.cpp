@@ -39,6 +39,10 @@
 
 namespace rainstorm {
   // more efficient implementations are welcome! 
+  // ROUNDS is the default number of weakfunc passes per block. The templates
+  // below take the count as a parameter, so fewer rounds (faster, for
+  // non-adversarial checksums) or more (extra margin) compile to their own
+  // unrolled code. Digests of different round counts are unrelated.
   constexpr int ROUNDS = 4;
   constexpr int FINAL_ROUNDS = 2;
 
@@ -92,169 +96,202 @@ namespace rainstorm {
     }
   }
 
+  static inline void initState(uint64_t* h, const seed_t seed, const size_t len) {
+    h[0]  = seed + len + 1;
+    h[1]  = seed + len + 2;
+    h[2]  = seed + len + 2;
+    h[3]  = seed + len + 3;
+    h[4]  = seed + len + 5;
+    h[5]  = seed + len + 7;
+    h[6]  = seed + len + 11;
+    h[7]  = seed + len + 13;
+    h[8]  = seed + len + 17;
+    h[9]  = seed + len + 19;
+    h[10] = seed + len + 23;
+    h[11] = seed + len + 29;
+    h[12] = seed + len + 31;
+    h[13] = seed + len + 37;
+    h[14] = seed + len + 41;
+    h[15] = seed + len + 43;
+  }
+
+  // Absorb one 512-bit block
+  template <bool bswap, int rounds = ROUNDS>
+  static inline void absorb(uint64_t* h, const uint8_t* data) {
+    static_assert(rounds > 0, "Rainstorm needs at least one round per block");
+    uint64_t temp[8];
+    for (int i = 0, j = 0; i < 8; ++i, j+= 8) {
+      temp[i] = GET_U64<bswap>(data, j);
+    }
+
+    for( int i = 0; i < rounds; i++) {
+      weakfunc(h, temp, i&1);
+    }
+  }
+
+  // Pad and process the last lenRemaining < 64 bytes, then run the final rounds
+  template <uint32_t hashsize, int rounds = ROUNDS>
+  static inline void closeState(uint64_t* h, const uint8_t* data, uint64_t lenRemaining) {
+    uint64_t temp[8];
+
+    // Pad and process any remaining data less than 64 bytes (512 bits)
+    memset(temp, (0x80+lenRemaining) & 255, sizeof(temp));
+    memcpy(temp, data, lenRemaining);
+    temp[lenRemaining >> 3] |= (uint64_t)(lenRemaining << ((lenRemaining&7)*8));
+
+    for( int i = 0; i < rounds; i++) {
+      weakfunc(h, temp, i&1);
+    }
+
+    // Final processing
+    for (int i = 0, j = 8; i < 8; i++, j++) {
+      h[i] -= h[j];
+    }
+
+    if ( hashsize > 64 ) {
+      for( int i = 0; i < std::max((int)hashsize / 64, FINAL_ROUNDS); i++ ) weakfunc(h, temp, true);
+    }
+  }
+
+  // Output the hash
+  template <uint32_t hashsize, bool bswap>
+  static inline void squeeze(const uint64_t* h, void* out) {
+    for (uint32_t i = 0, j = 0; i < std::min<uint32_t>(8, hashsize / 64); i++, j+= 8) {
+      PUT_U64<bswap>(h[i], (uint8_t *)out, j);
+    }
+  }
+
+  // Process the remaining 512-bit blocks, pad the last partial one and write the digest
+  // Split out of rainstorm() so the multi-buffer kernels can hand each lane back to it
+  template <uint32_t hashsize, bool bswap, int rounds = ROUNDS>
+  static inline void finish(uint64_t* h, const uint8_t* data, uint64_t lenRemaining, void* out) {
+    // Process 512-bit blocks
+    while (lenRemaining >= 64) {
+      absorb<bswap, rounds>(h, data);
+      data += 64;
+      lenRemaining -= 64;
+    }
+
+    closeState<hashsize, rounds>(h, data, lenRemaining);
+    squeeze<hashsize, bswap>(h, out);
+  }
+
   // streaming mode affordances
-  struct HashState : IHashState {
+  // hashsize and byte order are template parameters, so update and finalize
+  // inline fully with no dispatch; the CLI wraps this in ErasedHashState
+  template <uint32_t hashsize, bool bswap = ::bswap, int rounds = ROUNDS>
+  struct HashState {
     uint64_t  h[16];
-    seed_t    seed;
     size_t    len;                  // length processed so far
-    size_t    olen;
-    uint32_t  hashsize;
-    bool      inner = 0;
-    bool      final_block = false;
+    size_t    total_len;            // length promised to initialize
+    uint8_t   buffer[64];           // partial block carried between updates
+    size_t    buffered = 0;
     bool      finalized = false;
 
     // Initialize the state with known length
-    static HashState initialize(const seed_t seed, size_t olen, uint32_t hashsize) {
+    static HashState initialize(const seed_t seed, size_t olen) {
       HashState state;
-      // initialize h based on rainstorm
-
-      state.h[0] = seed + olen + 1;
-      state.h[1] = seed + olen + 2;
-      state.h[2] = seed + olen + 2;
-      state.h[3] = seed + olen + 3;
-      state.h[4] = seed + olen + 5;
-      state.h[5] = seed + olen + 7;
-      state.h[6] = seed + olen + 11;
-      state.h[7] = seed + olen + 13;
-      state.h[8] = seed + olen + 17;
-      state.h[9] = seed + olen + 19;
-      state.h[10] = seed + olen + 23;
-      state.h[11] = seed + olen + 29;
-      state.h[12] = seed + olen + 31;
-      state.h[13] = seed + olen + 37;
-      state.h[14] = seed + olen + 41;
-      state.h[15] = seed + olen + 43;
-
+      initState(state.h, seed, olen);
       state.len = 0;  // initialize length counter
-      state.seed = seed;
-      state.olen = olen;
-      state.hashsize = hashsize;
+      state.total_len = olen;
       return state;
     }
 
-    // Update the state with a new chunk of data
+    // Update the state with a new chunk of data, of any length
+    // Full blocks are absorbed as they arrive, and up to 63 trailing bytes are
+    // held back until the next update or finalize
     void update(const uint8_t* chunk, size_t chunk_len) {
-      uint64_t temp[8];
-      if ( this->final_block ) {
-        // throw
+      if ( this->finalized ) {
+        return;
       }
-
-      while (chunk_len >= 64) {
-        for (int i = 0, j = 0; i < 8; ++i, j += 8) {
-          temp[i] = GET_U64<false>(chunk, j);
-        }
-
-        for (int i = 0; i < ROUNDS; i++) {
-          weakfunc(this->h, temp, i & 1);
+      this->len += chunk_len;
+
+      if ( this->buffered ) {
+        size_t take = std::min(chunk_len, sizeof(this->buffer) - this->buffered);
+        memcpy(this->buffer + this->buffered, chunk, take);
+        this->buffered += take;
+        chunk += take;
+        chunk_len -= take;
+        if ( this->buffered < sizeof(this->buffer) ) {
+          return;
         }
+        absorb<bswap, rounds>(this->h, this->buffer);
+        this->buffered = 0;
+      }
 
+      while (chunk_len >= 64) {
+        absorb<bswap, rounds>(this->h, chunk);
         chunk += 64;
         chunk_len -= 64;
-        this->len += 64;
       }
 
-      // If it's less than a block of data left, it's the final chunk
-      if (chunk_len > 0 || this->olen == 0) {
-        // Pad and process any remaining data less than 64 bytes (512 bits)
-        memset(temp, (0x80 + chunk_len) & 255, sizeof(temp));
-        memcpy(temp, chunk, chunk_len);
-        temp[chunk_len >> 3] |= chunk_len >> (chunk_len - 56) * 8;
-
-        for (int i = 0; i < ROUNDS; i++) {
-          weakfunc(this->h, temp, i & 1);
-        }
-
-        for (int i = 0, j = 8; i < 8; i++, j++) {
-          h[i] -= h[j];
-        }
-
-        if (hashsize > 64) {
-          for (int i = 0; i < std::max((int)this->hashsize / 64, FINAL_ROUNDS); i++) weakfunc(h, temp, true);
-        }
-
-        this->len += chunk_len;
-        this->final_block = true;
-      }
+      memcpy(this->buffer, chunk, chunk_len);
+      this->buffered = chunk_len;
     }
 
     // Finalize the hash and return the result
-    void finalize(void* out) {
+    // Pads whatever is buffered, even an empty block when the input ended
+    // exactly on a block boundary
+    // Returns false, writing nothing, if the updates did not add up to the
+    // length given to initialize or the state was already finalized
+    bool finalize(void* out) {
       // finalize hash
-      if (finalized) {
-        return;
+      if (finalized || len != total_len) {
+        return false;
       } 
 
-      // Output requested hash size
-      for (int i = 0, j = 0; i < std::min(8, (int)this->hashsize / 64); i++, j += 8) {
-        PUT_U64<false>(h[i], (uint8_t *)out, j);
-      }
+      closeState<hashsize, rounds>(h, buffer, buffered);
 
+      // Output requested hash size
+      squeeze<hashsize, bswap>(h, out);
       finalized = true;
+      return true;
     }
   };
 
-  template <uint32_t hashsize, bool bswap>
+  template <uint32_t hashsize, bool bswap, int rounds = ROUNDS>
   static void rainstorm(const void* in, const size_t len, const seed_t seed, void* out) {
-    const uint8_t * data = (const uint8_t *)in;
-    uint64_t h[16] = {
-        seed + len + 1,
-        seed + len + 2,
-        seed + len + 2,
-        seed + len + 3,
-        seed + len + 5,
-        seed + len + 7,
-        seed + len + 11,
-        seed + len + 13,
-        seed + len + 17,
-        seed + len + 19,
-        seed + len + 23,
-        seed + len + 29,
-        seed + len + 31,
-        seed + len + 37,
-        seed + len + 41,
-        seed + len + 43
-    };
-
-    uint64_t temp[8];
-    uint64_t lenRemaining = len;
-
-    // Process 512-bit blocks
-    while (lenRemaining >= 64) {
-      for (int i = 0, j = 0; i < 8; ++i, j+= 8) {
-        temp[i] = GET_U64<bswap>(data, j);
-      }
-
-      for( int i = 0; i < ROUNDS; i++) {
-        weakfunc(h, temp, i&1);
-      }
-
-      data += 64;
-      lenRemaining -= 64;
-    }
-
-    // Pad and process any remaining data less than 64 bytes (512 bits)
-    memset(temp, (0x80+lenRemaining) & 255, sizeof(temp));
-    memcpy(temp, data, lenRemaining);
-    temp[lenRemaining >> 3] |= (uint64_t)(lenRemaining << ((lenRemaining&7)*8));
-
-    for( int i = 0; i < ROUNDS; i++) {
-      weakfunc(h, temp, i&1);
-    }
+    uint64_t h[16];
+    initState(h, seed, len);
+    finish<hashsize, bswap, rounds>(h, static_cast<const uint8_t *>(in), len, out);
+  }
 
-    // Final processing
-    for (int i = 0, j = 8; i < 8; i++, j++) {
-      h[i] -= h[j];
+  // Seed-bound hasher, as in rainbow::Keyed: the sixteen seeded state words
+  // are prepared once and each hash adds the length in. Copy it freely, one
+  // per thread. Digests match rainstorm<hashsize, bswap, rounds> with the same seed.
+  //
+  //   rainstorm::Keyed<512> tenant(seed);
+  //   tenant.hash(data, len, out);
+  template <uint32_t hashsize = 256, bool bswap = ::bswap, int rounds = ROUNDS>
+  struct Keyed {
+    static_assert(hashsize == 64 || hashsize == 128 || hashsize == 256 || hashsize == 512, "Rainstorm digests are 64, 128, 256 or 512 bits");
+
+    uint64_t iv[16];
+    seed_t   seed;
+
+    explicit Keyed(const seed_t seed = 0) : seed(seed) {
+      initState(iv, seed, 0);
     }
 
-    if ( hashsize > 64 ) {
-      for( int i = 0; i < std::max((int)hashsize / 64, FINAL_ROUNDS); i++ ) weakfunc(h, temp, true);
+    void hash(const void* in, const size_t len, void* out) const {
+      uint64_t h[16];
+      for (int i = 0; i < 16; i++) {
+        h[i] = iv[i] + len;
+      }
+      finish<hashsize, bswap, rounds>(h, static_cast<const uint8_t *>(in), len, out);
     }
 
-    // Output the hash
-    for (uint32_t i = 0, j = 0; i < std::min(8, (int)hashsize / 64); i++, j+= 8) {
-      PUT_U64<bswap>(h[i], (uint8_t *)out, j);
+    // Streaming state for a message of total_len bytes
+    HashState<hashsize, bswap, rounds> stream(const size_t total_len) const {
+      HashState<hashsize, bswap, rounds> state;
+      for (int i = 0; i < 16; i++) {
+        state.h[i] = iv[i] + total_len;
+      }
+      state.len = 0;
+      state.total_len = total_len;
+      return state;
     }
-  }
+  };
 }
 
 #ifdef __EMSCRIPTEN__
@@ -275,5 +312,39 @@ extern "C" {
   KEEPALIVE void rainstormHash512(const void* in, const size_t len, const seed_t seed, void* out) {
     rainstorm::rainstorm<512, false>(in, len, seed, out);
   }
+
+  // Streaming, used the same way as the rainbowStream functions
+  KEEPALIVE void* rainstormStreamInit(const uint32_t hashsize, const seed_t seed, const uint64_t total_len) {
+    switch (hashsize) {
+      case 64:
+        return new WasmStream(new ErasedHashState<rainstorm::HashState<64, false>>(rainstorm::HashState<64, false>::initialize(seed, total_len)));
+      case 128:
+        return new WasmStream(new ErasedHashState<rainstorm::HashState<128, false>>(rainstorm::HashState<128, false>::initialize(seed, total_len)));
+      case 256:
+        return new WasmStream(new ErasedHashState<rainstorm::HashState<256, false>>(rainstorm::HashState<256, false>::initialize(seed, total_len)));
+      case 512:
+        return new WasmStream(new ErasedHashState<rainstorm::HashState<512, false>>(rainstorm::HashState<512, false>::initialize(seed, total_len)));
+    }
+    return nullptr;
+  }
+
+  KEEPALIVE uint8_t* rainstormStreamBuffer(void* stream) {
+    return static_cast<WasmStream*>(stream)->input;
+  }
+
+  KEEPALIVE size_t rainstormStreamBufferSize() {
+    return WASM_STREAM_BUFFER;
+  }
+
+  KEEPALIVE void rainstormStreamUpdate(void* stream, const size_t len) {
+    WasmStream* s = static_cast<WasmStream*>(stream);
+    s->state->update(s->input, std::min(len, WASM_STREAM_BUFFER));
+  }
+
+  KEEPALIVE void rainstormStreamFinal(void* stream, void* out) {
+    WasmStream* s = static_cast<WasmStream*>(stream);
+    s->state->finalize(out);
+    delete s;
+  }
 }
 #endif
@@ -4,154 +4,804 @@
 #include <vector>
 #include <string>
 #include <ctime>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <system_error>
+#include <thread>
 #include "tool.h"
+#include "pool.h"
+#include "numa.h"
+#include "multibuffer.h"
+#include "tree.h"
+#include "xof.h"
+#include "keystream.h"
+#include "reader.h"
+#include "chunker.h"
+#include "index.h"
+#include "kernels.h"
+#include "digest.h"
+#include "serve.h"
+#ifdef USE_FILESYSTEM
+#include "walk.h"
+#endif
+
+// Stream mode: the first block is the hash of the input and each block after it
+// is the hash of the one before, all written through one large buffer
+template<raintree::hash_fn hash, size_t byte_size>
+void feedback(const uint8_t* input, size_t input_len, uint64_t seed, uint64_t output_length, OutputBuffer& output) {
+  uint8_t block[byte_size];
+  uint8_t next[byte_size];
+  hash(input, input_len, seed, block);
+  while (true) {
+    size_t chunk_size = std::min<uint64_t>(output_length, byte_size);
+    output.buffer().append(reinterpret_cast<const char*>(block), chunk_size);
+    output.commit();
+
+    output_length -= chunk_size;
+    if(output_length == 0) {
+      break;
+    }
+
+    hash(block, chunk_size, seed, next);
+    std::memcpy(block, next, byte_size);
+  }
+}
 
 template<bool bswap>
-void invokeHash(HashAlgorithm algot, uint64_t seed, std::vector<uint8_t>& buffer, std::vector<uint8_t>& temp_out, int hash_size) {
+void invokeFeedback(HashAlgorithm algot, uint64_t seed, const uint8_t* data, size_t len, uint64_t output_length, OutputBuffer& output, int hash_size, int rounds) {
   if(algot == HashAlgorithm::Rainbow) {
     switch(hash_size) {
       case 64:
-        rainbow::rainbow<64, bswap>(buffer.data(), buffer.size(), seed, temp_out.data());
+        feedback<rainbow::rainbow<64, bswap>, 8>(data, len, seed, output_length, output);
         break;
       case 128:
-        rainbow::rainbow<128, bswap>(buffer.data(), buffer.size(), seed, temp_out.data());
+        feedback<rainbow::rainbow<128, bswap>, 16>(data, len, seed, output_length, output);
         break;
       case 256:
-        rainbow::rainbow<256, bswap>(buffer.data(), buffer.size(), seed, temp_out.data());
+        feedback<rainbow::rainbow<256, bswap>, 32>(data, len, seed, output_length, output);
         break;
       default:
         throw std::runtime_error("Invalid hash_size for rainbow");
     }
   } else if(algot == HashAlgorithm::Rainstorm) {
-    switch(hash_size) {
-      case 64:
-        rainstorm::rainstorm<64, bswap>(buffer.data(), buffer.size(), seed, temp_out.data());
-        break; // NOTE: I'm not sure whether it's a bug or an intentional approach. Assuming similar as Rainbow.
-      case 128:
-        rainstorm::rainstorm<128, bswap>(buffer.data(), buffer.size(), seed, temp_out.data());
-        break;
-      case 256:
-        rainstorm::rainstorm<256, bswap>(buffer.data(), buffer.size(), seed, temp_out.data());
-        break;
-      case 512:
-        rainstorm::rainstorm<512, bswap>(buffer.data(), buffer.size(), seed, temp_out.data());
-        break;
-      default:
-        throw std::runtime_error("Invalid hash_size for rainstorm");
-    }
+    withRounds(rounds, [&](auto r) {
+      switch(hash_size) {
+        case 64:
+          feedback<rainstorm::rainstorm<64, bswap, r>, 8>(data, len, seed, output_length, output);
+          break;
+        case 128:
+          feedback<rainstorm::rainstorm<128, bswap, r>, 16>(data, len, seed, output_length, output);
+          break;
+        case 256:
+          feedback<rainstorm::rainstorm<256, bswap, r>, 32>(data, len, seed, output_length, output);
+          break;
+        case 512:
+          feedback<rainstorm::rainstorm<512, bswap, r>, 64>(data, len, seed, output_length, output);
+          break;
+        default:
+          throw std::runtime_error("Invalid hash_size for rainstorm");
+      }
+    });
   } else {
     throw std::runtime_error("Invalid algorithm: " + hashAlgoToString(algot));
   }
 }
 
-void hashBuffer(Mode mode, HashAlgorithm algot, std::vector<uint8_t>& buffer, uint64_t seed, uint64_t output_length, std::ostream& outstream, uint32_t hash_size) {
-  int byte_size = hash_size / 8;
-  std::vector<uint8_t> temp_out(byte_size);
-  
+void hashBuffer(Mode mode, HashAlgorithm algot, const uint8_t* data, size_t len, uint64_t seed, uint64_t output_length, std::ostream& outstream, uint32_t hash_size, int rounds) {
+  size_t byte_size = hash_size / 8;
+  uint8_t temp_out[64];
+
   if(mode == Mode::Digest) {
-    invokeHash<bswap>(algot, seed, buffer, temp_out, hash_size);
-    
-    for (const auto& byte : temp_out) {
-      outstream << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(byte);
+    invokeHash<bswap>(algot, seed, data, len, temp_out, hash_size, rounds);
+
+    static const char digits[] = "0123456789abcdef";
+    char hex[128];
+    for (size_t i = 0; i < byte_size; i++) {
+      hex[2 * i] = digits[temp_out[i] >> 4];
+      hex[2 * i + 1] = digits[temp_out[i] & 15];
     }
+    outstream.write(hex, 2 * byte_size);
   }
   else if(mode == Mode::Stream) {
-    while(output_length > 0) {
-      invokeHash<bswap>(algot, seed, buffer, temp_out, hash_size);
+    OutputBuffer output(outstream);
+    invokeFeedback<bswap>(algot, seed, data, len, output_length, output, hash_size, rounds);
+  }
+}
 
-      uint64_t chunk_size = std::min(output_length, (uint64_t)byte_size);
-      outstream.write(reinterpret_cast<const char*>(temp_out.data()), chunk_size);
+// Write output_length bytes of a seekable generator, starting at opts.offset.
+// Each round fills one segment per worker, in parallel on the pool, then writes them in order.
+void writeSeekable(const HashOptions& opts, uint64_t output_length, std::ostream& outstream, const std::function<void(uint64_t, uint8_t*, size_t)>& generate) {
+  size_t workers = opts.pool ? opts.pool->size() : 1;
+  std::vector<std::vector<uint8_t>> segments(workers, std::vector<uint8_t>(std::min<uint64_t>(SEEKABLE_SEGMENT, output_length)));
 
-      output_length -= chunk_size;
-      if(output_length == 0) {
-        break;
-      }
+  TaskGroup tasks(opts.pool);
+  for (uint64_t done = 0; done < output_length; ) {
+    std::vector<size_t> lengths;
+    for (size_t i = 0; i < workers && done < output_length; i++) {
+      size_t len = std::min<uint64_t>(SEEKABLE_SEGMENT, output_length - done);
+      uint8_t* dst = segments[i].data();
+      uint64_t offset = opts.offset + done;
+      tasks.run([&generate, offset, dst, len] { generate(offset, dst, len); });
+      lengths.push_back(len);
+      done += len;
+    }
+    tasks.wait();
+    for (size_t i = 0; i < lengths.size(); i++) {
+      outstream.write(reinterpret_cast<const char*>(segments[i].data()), lengths[i]);
+    }
+  }
+  outstream.flush();
+}
+
+// Xof mode: output squeezed from a Rainstorm XOF keyed by the digest.
+// Keystream mode: counter-mode Rainstorm blocks keyed by the digest.
+void writeKeyed(Mode mode, const HashOptions& opts, const Digest& digest, uint64_t output_length, std::ostream& outstream) {
+  if (mode == Mode::Xof) {
+    rainstorm::Xof xof = rainstorm::Xof::keyed(digest.data(), digest.size(), opts.seed);
+    writeSeekable(opts, output_length, outstream, [&xof](uint64_t offset, uint8_t* dst, size_t len) {
+      xof.read(offset, dst, len);
+    });
+  } else {
+    writeSeekable(opts, output_length, outstream, [&](uint64_t offset, uint8_t* dst, size_t len) {
+      rainstorm::keystream<bswap>(digest.data(), digest.size(), opts.seed, offset, dst, len);
+    });
+  }
+}
 
-      // Update buffer with the output of the last hash operation
-      buffer.assign(temp_out.begin(), temp_out.begin() + chunk_size);
+// Write a finished digest, continuing the feedback stream from it in stream mode
+// and keying the XOF or keystream with it in xof and keystream modes
+void writeDigest(Mode mode, const HashOptions& opts, Digest& digest, uint64_t output_length, std::ostream& outstream, const std::string& name) {
+  PhaseTimer timer(opts.stats, Phase::Output);
+  if (mode == Mode::Digest) {
+    std::string line;
+    appendDigest(line, opts.format, digest.data(), digest.size(), name);
+    outstream.write(line.data(), line.size());
+  } else if (mode == Mode::Xof || mode == Mode::Keystream) {
+    writeKeyed(mode, opts, digest, output_length, outstream);
+  } else {
+    uint64_t chunk_size = std::min(output_length, (uint64_t)digest.size());
+    outstream.write(reinterpret_cast<const char*>(digest.data()), chunk_size);
+    if (output_length > chunk_size) {
+      hashBuffer(mode, opts.algot, digest.data(), chunk_size, opts.seed, output_length - chunk_size, outstream, opts.size, opts.rounds);
     }
   }
 }
 
-void hashAnything(Mode mode, HashAlgorithm algot, const std::string& inpath, std::ostream& outstream, uint32_t size, bool use_test_vectors, uint64_t seed, uint64_t output_length) {
-    std::vector<uint8_t> buffer;
-    std::vector<uint8_t> chunk(CHUNK_SIZE);
+// --chunks: split one input into content-defined chunks and write a record
+// for each, through raincdc::digestChunks. Mapped files are cut in one pass
+// over memory, and every CHUNK_BATCH chunks go through invokeMany while their
+// bytes are still in cache from the cut search. Streamed input reuses its
+// buffer after each chunk, so those chunks are hashed one by one.
+void writeChunks(const HashOptions& opts, const std::string& inpath, std::ostream& outstream) {
+    raincdc::Params params = raincdc::Params::forAverage(opts.chunk_avg);
+    const std::string name = inpath.empty() ? "stdin" : inpath;
+    const size_t digest_len = opts.size / 8;
+    OutputBuffer output(outstream);
+
+    auto many = [&](const void* const* in, const size_t* len, size_t n, void* const* out) {
+      PhaseTimer timer(opts.stats, Phase::Hash);
+      invokeMany<bswap>(opts.algot, opts.seed, in, len, n, out, opts.size, opts.rounds);
+      if (opts.stats) {
+        for (size_t i = 0; i < n; i++) {
+          opts.stats->addBytes(len[i]);
+        }
+      }
+    };
+    auto emit = [&](uint64_t offset, size_t len, const uint8_t* digest) {
+      PhaseTimer timer(opts.stats, Phase::Output);
+      appendChunkRecord(output.buffer(), opts.format, offset, len, digest, digest_len, name);
+      output.commit();
+    };
+
+    if (!inpath.empty() && opts.use_mmap) {
+      std::unique_ptr<MappedFile> map;
+      {
+        PhaseTimer timer(opts.stats, Phase::Read);
+        map = std::make_unique<MappedFile>(inpath);
+      }
+      if (map->data) {
+        raincdc::digestChunks(map->data, map->size, params, digest_len, many, emit);
+        return;
+      }
+    }
+
+    auto chunkStream = [&](auto read) {
+      auto timedRead = [&](uint8_t* dst, size_t max) {
+        PhaseTimer timer(opts.stats, Phase::Read);
+        return read(dst, max);
+      };
+      raincdc::digestChunkStream(timedRead, params, digest_len, many, emit);
+    };
+
+#ifndef _WIN32
+    if (!inpath.empty() && isRegularFile(inpath)) {
+      PipelinedReader reader(inpath, opts.direct, ioBlockSize(opts, inpath));
+      chunkStream([&](uint8_t* dst, size_t max) { return reader.read(dst, max); });
+      return;
+    }
+#endif
+    std::ifstream infile;
+    if (!inpath.empty()) {
+      infile.open(inpath, std::ios::binary);
+      if (infile.fail()) {
+        throw std::runtime_error("Cannot open file for reading: " + inpath);
+      }
+    }
+    std::istream& in_stream = inpath.empty() ? getInputStream() : infile;
+    chunkStream([&](uint8_t* dst, size_t max) {
+      in_stream.read(reinterpret_cast<char*>(dst), max);
+      if (in_stream.bad()) {
+        throw std::runtime_error("Input could not be read: " + name);
+      }
+      return static_cast<size_t>(in_stream.gcount());
+    });
+}
+
+#ifndef _WIN32
+// --index: tree digest of one regular file that re-reads only the leaves which
+// may have changed since the index was written, then updates the index
+void digestIndexed(const HashOptions& opts, const std::string& inpath, Digest& digest) {
+    int fd = open(inpath.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+      if (fd >= 0) {
+        close(fd);
+      }
+      throw std::runtime_error("--index needs a regular file: " + inpath);
+    }
+    std::unique_ptr<int, void(*)(int*)> fd_guard(&fd, [](int* f) { close(*f); });
+    FileIdentity before = FileIdentity::of(st);
+    uint64_t input_length = before.size;
+
+    // A single leaf hashes as the plain function does, there is nothing to reuse
+    if (input_length <= raintree::LEAF_SIZE) {
+      digestFile(opts, inpath, digest);
+      return;
+    }
+
+    const size_t cv_size = treeCvSize(opts.algot);
+    const uint64_t leaves = raintree::leafCount(input_length);
+    auto leafLength = [](uint64_t leaf, uint64_t total) {
+      uint64_t start = leaf * raintree::LEAF_SIZE;
+      return start >= total ? 0 : std::min<uint64_t>(raintree::LEAF_SIZE, total - start);
+    };
+
+    TreeIndex index;
+    bool usable = index.load(opts.index) && index.algorithm == static_cast<uint64_t>(opts.algot) && index.seed == opts.seed &&
+                  index.leaf_size == raintree::LEAF_SIZE && index.cv_size == cv_size && index.file.sameFile(before);
+    std::vector<uint8_t> cvs(leaves * cv_size);
+    std::vector<bool> stale(leaves, true);
+    if (usable && (index.file.unchanged(before) || !opts.dirty.empty())) {
+      for (uint64_t leaf = 0; leaf < std::min(leaves, index.leaves); leaf++) {
+        if (leafLength(leaf, index.file.size) == leafLength(leaf, input_length)) {
+          std::memcpy(cvs.data() + leaf * cv_size, index.cvs.data() + leaf * cv_size, cv_size);
+          stale[leaf] = false;
+        }
+      }
+      for (const auto& range : opts.dirty) {
+        // saturates, so a length reaching past the end cannot wrap around
+        uint64_t end = range.first >= input_length ? input_length : range.first + std::min(range.second, input_length - range.first);
+        for (uint64_t leaf = range.first / raintree::LEAF_SIZE; leaf < leaves && leaf * raintree::LEAF_SIZE < end; leaf++) {
+          stale[leaf] = true;
+        }
+      }
+    }
+
+    // Hole leaves get the chaining value of zeros, computed once per length
+    std::vector<bool> has_data = dataLeaves(fd, input_length, raintree::LEAF_SIZE);
+    std::vector<uint8_t> zeros;
+    std::vector<uint8_t> zero_cv[2];
+    std::vector<uint64_t> to_read;
+    for (uint64_t leaf = 0; leaf < leaves; leaf++) {
+      if (!stale[leaf]) {
+        continue;
+      }
+      if (has_data[leaf]) {
+        to_read.push_back(leaf);
+        continue;
+      }
+      size_t len = leafLength(leaf, input_length);
+      std::vector<uint8_t>& cv = zero_cv[len == raintree::LEAF_SIZE ? 0 : 1];
+      if (cv.empty()) {
+        zeros.assign(raintree::LEAF_SIZE, 0);
+        cv.resize(cv_size);
+        const void* in = zeros.data();
+        void* out = cv.data();
+        hashLeaves(opts, &in, &len, 1, &out);
+      }
+      std::memcpy(cvs.data() + leaf * cv_size, cv.data(), cv_size);
+    }
+
+    // Read and hash the rest a round at a time, one group of leaves per worker
+    size_t round = raintree::LEAF_GROUP * (opts.pool ? opts.pool->size() : 1);
+    std::vector<std::vector<uint8_t>> buffers(std::min<uint64_t>(round, to_read.size()), std::vector<uint8_t>(raintree::LEAF_SIZE));
+    TaskGroup tasks(opts.pool);
+    for (size_t first = 0; first < to_read.size(); first += buffers.size()) {
+      size_t last = std::min(to_read.size(), first + buffers.size());
+      for (size_t group = first; group < last; group += raintree::LEAF_GROUP) {
+        size_t n = std::min<size_t>(raintree::LEAF_GROUP, last - group);
+        std::vector<const void*> leaf_in(n);
+        std::vector<size_t> leaf_len(n);
+        std::vector<void*> leaf_cv(n);
+        for (size_t i = 0; i < n; i++) {
+          uint64_t leaf = to_read[group + i];
+          uint8_t* buffer = buffers[group + i - first].data();
+          leaf_in[i] = buffer;
+          leaf_len[i] = leafLength(leaf, input_length);
+          leaf_cv[i] = cvs.data() + leaf * cv_size;
+          PhaseTimer timer(opts.stats, Phase::Read);
+          size_t got = 0;
+          while (got < leaf_len[i]) {
+            ssize_t bytes_read = pread(fd, buffer + got, leaf_len[i] - got, leaf * raintree::LEAF_SIZE + got);
+            if (bytes_read <= 0) {
+              throw std::runtime_error("Input file could not be read: " + inpath);
+            }
+            got += bytes_read;
+          }
+          if (opts.stats) {
+            opts.stats->addBytes(leaf_len[i]);
+          }
+        }
+        tasks.run([&opts, leaf_in, leaf_len, leaf_cv, n] {
+          hashLeaves(opts, leaf_in.data(), leaf_len.data(), n, leaf_cv.data());
+        });
+      }
+      tasks.wait();
+    }
+
+    {
+      PhaseTimer timer(opts.stats, Phase::Finalize);
+      std::vector<uint8_t> node = raintree::parentNode(cvs.data(), cvs.size(), input_length);
+      invokeHash<bswap>(opts.algot, opts.seed ^ raintree::PARENT_DOMAIN, node.data(), node.size(), digest.data(), opts.size, opts.rounds);
+    }
+
+    // A file written to while we read it would leave stale values in the
+    // index, so only save it when nothing moved
+    if (fstat(fd, &st) != 0 || !FileIdentity::of(st).unchanged(before)) {
+      std::cerr << "rainsum: " << inpath << " changed while it was hashed, index not updated\n";
+      return;
+    }
+    index.algorithm = static_cast<uint64_t>(opts.algot);
+    index.seed = opts.seed;
+    index.file = before;
+    index.leaf_size = raintree::LEAF_SIZE;
+    index.cv_size = cv_size;
+    index.leaves = leaves;
+    index.cvs = std::move(cvs);
+    index.save(opts.index);
+}
+#endif
+
+// Hash the test vectors (twice over, to fill all eight lanes) through invokeMany
+// and make sure every lane agrees with the one-shot hash
+void checkManyAgainstScalar(const HashOptions& opts) {
+    std::vector<const void*> in;
+    std::vector<size_t> len;
+    for (int pass = 0; pass < 2; pass++) {
+      for (const auto& test_vector : test_vectors) {
+        in.push_back(test_vector.data());
+        len.push_back(test_vector.size());
+      }
+    }
+    std::vector<Digest> many(in.size(), Digest(opts.size / 8));
+    std::vector<void*> out;
+    for (auto& digest : many) {
+      out.push_back(digest.data());
+    }
+    invokeMany<bswap>(opts.algot, opts.seed, in.data(), len.data(), in.size(), out.data(), opts.size, opts.rounds);
+
+    Digest digest(opts.size / 8);
+    for (size_t i = 0; i < in.size(); i++) {
+      invokeHash<bswap>(opts.algot, opts.seed, static_cast<const uint8_t*>(in[i]), len[i], digest.data(), opts.size, opts.rounds);
+      if (digest != many[i]) {
+        throw std::runtime_error("Multi-buffer hash disagrees with the one-shot hash on test vector " + std::to_string(i % test_vectors.size()));
+      }
+    }
+}
+
+void hashAnything(Mode mode, const HashOptions& opts, const std::string& inpath, std::ostream& outstream, bool use_test_vectors, uint64_t output_length) {
+    Digest digest(opts.size / 8);
 
-    if (use_test_vectors) {
+    if (opts.chunk_avg && !use_test_vectors) {
+        FileTimer timer(opts.stats);
+        writeChunks(opts, inpath, outstream);
+    } else if (use_test_vectors) {
+        if (mode == Mode::Digest) {
+          checkManyAgainstScalar(opts);
+        }
         for (const auto& test_vector : test_vectors) {
-            buffer.assign(test_vector.begin(), test_vector.end());
-            hashBuffer(mode, algot, buffer, seed, output_length, outstream, size);
-            outstream << ' ' << '"' << test_vector << '"' << '\n';
+            const uint8_t* data = reinterpret_cast<const uint8_t*>(test_vector.data());
+            if (mode == Mode::Stream) {
+              hashBuffer(mode, opts.algot, data, test_vector.size(), opts.seed, output_length, outstream, opts.size, opts.rounds);
+              outstream << ' ' << '"' << test_vector << '"' << '\n';
+              continue;
+            }
+            invokeHash<bswap>(opts.algot, opts.seed, data, test_vector.size(), digest.data(), opts.size, opts.rounds);
+            writeDigest(mode, opts, digest, output_length, outstream, '"' + test_vector + '"');
+            if (mode != Mode::Digest) {
+              outstream << ' ' << '"' << test_vector << '"' << '\n';
+            }
         }
+    } else if (!inpath.empty()) {
+        {
+          FileTimer timer(opts.stats);
+#ifndef _WIN32
+          if (!opts.index.empty()) {
+            digestIndexed(opts, inpath, digest);
+          } else
+#endif
+          digestFile(opts, inpath, digest);
+        }
+        writeDigest(mode, opts, digest, output_length, outstream, inpath);
     } else {
-        std::istream* in_stream = nullptr;
-        std::ifstream infile;
+        {
+          FileTimer timer(opts.stats);
+          digestUnsized(opts, getInputStream(), digest);
+        }
+        writeDigest(mode, opts, digest, output_length, outstream, "stdin");
+    }
+}
+
+// One file's result in hashBatch, waiting for its turn to be printed
+struct BatchSlot {
+    std::string line;
+    std::string path;
+    Digest digest;
+    std::string error;
+    uint64_t bytes = 0;
+    bool mismatch = false;
+    bool skipped = false;
+    bool ready = false;
+};
 
-        uint64_t input_length = 0;
+// Hash every entry next_entry() yields on the pool, printing lines in input order.
+// Workers run a few groups per thread ahead of the printer. When a slow file holds
+// up the printer while later files are done, the window grows, up to BATCH_WINDOW
+// files, so that file holds back the output but not the hashing. Entries with an expected digest are
+// verified instead of printed, and with fail_fast the first mismatch stops the run.
+// Each file is hashed whole by one worker, so tree leaves are never parallelized here.
+// With collected, each path and digest is appended to it instead of printed.
+// Returns nonzero if any file failed.
+int hashBatch(const HashOptions& opts, const std::function<bool(BatchEntry&)>& next_entry, std::ostream& outstream, unsigned threads, bool fail_fast, BatchTotals& totals,
+              std::vector<std::pair<std::string, Digest>>* collected = nullptr) {
+    // Kept for the process, so each -r --merkle root reuses the ring grown so far.
+    // Batch runs happen one at a time, from the main thread.
+    static std::vector<BatchSlot> slots;
+    slots.resize(std::max<uint64_t>(slots.size(), std::min<uint64_t>(BATCH_WINDOW, std::max(threads, 1u) * BATCH_GROUP * 4)));
+    size_t finished = 0;
+    std::mutex slots_mutex;
+    std::condition_variable slot_ready;
+    std::atomic<bool> stop{false};
+    uint64_t submitted = 0;
+    uint64_t printed = 0;
+    int status = 0;
 
-        if (!inpath.empty()) {
-            infile.open(inpath, std::ios::binary);
-            if (infile.fail()) {
-              throw std::runtime_error("Cannot open file for reading: " + inpath);
+    WorkPool pool(threads, opts.cpus);
+    OutputBuffer output(outstream);
+
+    auto printNext = [&]() {
+      BatchSlot slot;
+      {
+        std::unique_lock<std::mutex> lock(slots_mutex);
+        BatchSlot& head = slots[printed % slots.size()];
+        slot_ready.wait(lock, [&] { return head.ready; });
+        std::swap(slot, head);
+        finished--;
+      }
+      printed++;
+      // Once fail-fast has tripped, only the failure itself is still reported
+      if (slot.skipped || (fail_fast && status != 0)) {
+        return;
+      }
+      if (!slot.error.empty()) {
+        std::cerr << "rainsum: " << slot.error << '\n';
+        totals.unreadable++;
+        status = 1;
+      } else {
+        if (collected) {
+          collected->emplace_back(std::move(slot.path), std::move(slot.digest));
+        } else {
+          PhaseTimer timer(opts.stats, Phase::Output);
+          output.write(slot.line);
+        }
+        totals.files++;
+        totals.bytes += slot.bytes;
+        if (slot.mismatch) {
+          totals.mismatched++;
+          status = 1;
+        }
+      }
+    };
+
+    // Entries go to the pool in groups, so that small Rainstorm files can share
+    // one multi-buffer call
+    auto submitGroup = [&](std::vector<BatchEntry> group) {
+      if (!opts.use_mmap && !opts.direct) {
+        for (const auto& entry : group) {
+          prefetchFile(entry.path);
+        }
+      }
+      uint64_t first = submitted;
+      submitted += group.size();
+      pool.submit([&, first, group = std::move(group)]() {
+        std::vector<BatchSlot> results(group.size());
+        if (stop) {
+          for (auto& result : results) {
+            result.skipped = true;
+          }
+        } else {
+          std::vector<Digest> digests;
+          std::vector<std::string> errors;
+          digestGroup(opts, group, digests, errors);
+          for (size_t i = 0; i < group.size(); i++) {
+            const BatchEntry& entry = group[i];
+            BatchSlot& result = results[i];
+            result.error = errors[i];
+            if (result.error.empty()) {
+              result.bytes = entry.file_size >= 0 ? entry.file_size : getFileSize(entry.path);
+              if (collected) {
+                result.path = entry.path;
+                result.digest = std::move(digests[i]);
+              } else if (entry.expected.empty()) {
+                appendDigest(result.line, opts.format, digests[i].data(), digests[i].size(), entry.path);
+              } else {
+                // Manifests are always hex
+                std::string hex;
+                appendHex(hex, digests[i].data(), digests[i].size());
+                result.mismatch = hex != entry.expected;
+                result.line = entry.path + (result.mismatch ? ": FAILED\n" : ": OK\n");
+              }
             }
-            in_stream = &infile;
-            input_length = getFileSize(inpath);
-
-            std::unique_ptr<IHashState> state;
-            if(algot == HashAlgorithm::Rainbow) {
-              state = std::make_unique<rainbow::HashState>(rainbow::HashState::initialize(seed, input_length, size));
-            } else if(algot == HashAlgorithm::Rainstorm) {
-              state = std::make_unique<rainstorm::HashState>(rainstorm::HashState::initialize(seed, input_length, size));
-            } else {
-              throw std::runtime_error("Invalid algorithm: " + hashAlgoToString(algot));
+            if (fail_fast && (result.mismatch || !result.error.empty())) {
+              stop = true;
             }
+          }
+        }
+        {
+          std::lock_guard<std::mutex> lock(slots_mutex);
+          for (size_t i = 0; i < results.size(); i++) {
+            results[i].ready = true;
+            slots[(first + i) % slots.size()] = std::move(results[i]);
+          }
+          finished += results.size();
+        }
+        slot_ready.notify_one();
+      });
+    };
 
-            // Stream the file in 16384-byte chunks
-            while (*in_stream) {
-                in_stream->read(reinterpret_cast<char*>(chunk.data()), CHUNK_SIZE);
-                if (in_stream->fail() && !in_stream->eof()) {
-                  throw std::runtime_error("Input file could not be read after " + std::to_string(state->len) + " bytes processed.");
-                }
-                std::streamsize bytes_read = in_stream->gcount();
-                if (bytes_read > 0 || input_length == 0) {
-                    // Update the state with the new chunk of data
-                    state->update(chunk.data(), bytes_read);
-                }
+    // Waits until n more entries fit in the ring. Rather than wait on a head entry
+    // that is still hashing while later ones are done, the ring doubles.
+    auto makeRoom = [&](uint64_t n) {
+      while (submitted + n - printed > slots.size()) {
+        {
+          std::lock_guard<std::mutex> lock(slots_mutex);
+          if (!slots[printed % slots.size()].ready && finished > 0 && slots.size() < BATCH_WINDOW) {
+            std::vector<BatchSlot> grown(std::min<uint64_t>(BATCH_WINDOW, slots.size() * 2));
+            for (uint64_t i = printed; i < submitted; i++) {
+              grown[i % grown.size()] = std::move(slots[i % slots.size()]);
             }
+            slots.swap(grown);
+            continue;
+          }
+        }
+        printNext();
+      }
+    };
 
-            // Close the file if it's open
-            if (infile.is_open()) {
-                infile.close();
-            }
+    std::vector<BatchEntry> group;
+    BatchEntry entry;
+    while (!stop && next_entry(entry)) {
+      if (entry.file_size > static_cast<int64_t>(BATCH_LARGE_FILE)) {
+        makeRoom(1);
+        submitGroup({entry});
+        continue;
+      }
+      group.push_back(entry);
+      if (group.size() == BATCH_GROUP) {
+        makeRoom(group.size());
+        submitGroup(std::move(group));
+        group.clear();
+      }
+    }
+    if (!group.empty()) {
+      makeRoom(group.size());
+      submitGroup(std::move(group));
+    }
+    while (printed < submitted) {
+      printNext();
+    }
+    return status;
+}
 
-            // Finalize the hash
-            std::vector<uint8_t> output(output_length);
-            state->finalize(output.data());
+// Parse one "<hex> <path>" manifest line, as written by rainsum or sha256sum
+bool parseManifestLine(const std::string& line, BatchEntry& entry) {
+    size_t space = line.find(' ');
+    if (space == 0 || space == std::string::npos || space + 1 >= line.size()) {
+      return false;
+    }
+    entry.expected = line.substr(0, space);
+    for (auto& c : entry.expected) {
+      if (!std::isxdigit(static_cast<unsigned char>(c))) {
+        return false;
+      }
+      c = std::tolower(static_cast<unsigned char>(c));
+    }
+    // sha256sum separates with two spaces, or " *" for binary mode
+    size_t start = space + 1;
+    if ((line[start] == ' ' || line[start] == '*') && start + 1 < line.size()) {
+      start++;
+    }
+    entry.path = line.substr(start);
+    return true;
+}
 
-            //std::cout << "Length : " << state.len << std::endl;
-            //std::cout << "File length : " << input_length << std::endl;
+#ifndef _WIN32
+// Answer one run of --serve requests (see serve.h). A run of more than one
+// request is payloads with the same parameters, hashed in one invokeMany call.
+void answerRequests(const HashOptions& defaults, const std::vector<rainserve::Request>& run, rainserve::Connection& conn) {
+    const rainserve::Request& first = run.front();
+    HashOptions opts = defaults;
+    opts.algot = first.algorithm == 0 ? HashAlgorithm::Rainbow : first.algorithm == 1 ? HashAlgorithm::Rainstorm : HashAlgorithm::Unknown;
+    opts.size = first.bits;
+    opts.seed = first.seed;
+    opts.tree = first.flags & rainserve::FLAG_TREE;
 
+    std::string error;
+    if (first.op != rainserve::HashPayload && first.op != rainserve::HashFile) {
+      error = "unknown op " + std::to_string(first.op);
+    } else if (opts.algot == HashAlgorithm::Unknown) {
+      error = "unknown algorithm " + std::to_string(first.algorithm);
+    } else if (!validHashSize(opts.algot, opts.size)) {
+      error = "invalid size " + std::to_string(opts.size) + " for " + hashAlgoToString(opts.algot);
+    }
+    if (!error.empty()) {
+      for (const auto& request : run) {
+        conn.reply(request.id, 1, error.data(), error.size());
+      }
+      return;
+    }
 
-            // Write the output to the outstream
+    size_t digest_len = opts.size / 8;
+    if (first.op == rainserve::HashFile) {
+      Digest digest(digest_len);
+      try {
+        digestFile(opts, std::string(reinterpret_cast<const char*>(first.payload), first.length), digest);
+        conn.reply(first.id, 0, digest.data(), digest_len);
+      } catch (const std::exception& e) {
+        error = e.what();
+        conn.reply(first.id, 1, error.data(), error.size());
+      }
+      return;
+    }
 
-            if (mode == Mode::Digest) {
-              for (const auto& byte : output) {
-                outstream << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(byte);
-              }
-              outstream << ' ' << (inpath.empty() ? "stdin" : inpath) << '\n';
-            } else {
-              outstream.write(reinterpret_cast<char*>(output.data()), output_length);
-            }
-        } else {
-          in_stream = &getInputStream();
-          // Read all data into the buffer
-          buffer = std::vector<uint8_t>(std::istreambuf_iterator<char>(*in_stream), {});
-          input_length = buffer.size();
-          hashBuffer(mode, algot, buffer, seed, output_length, outstream, size);
-          outstream << ' ' << (inpath.empty() ? "stdin" : inpath) << '\n';
+    uint8_t digests[rainserve::SERVE_BATCH][64];
+    if (run.size() == 1) {
+      if (opts.tree) {
+        invokeTree<bswap>(opts.algot, opts.seed, first.payload, first.length, digests[0], opts.size, opts.pool, opts.rounds);
+      } else {
+        invokeHash<bswap>(opts.algot, opts.seed, first.payload, first.length, digests[0], opts.size, opts.rounds);
+      }
+    } else {
+      const void* in[rainserve::SERVE_BATCH];
+      size_t len[rainserve::SERVE_BATCH];
+      void* out[rainserve::SERVE_BATCH];
+      for (size_t i = 0; i < run.size(); i++) {
+        in[i] = run[i].payload;
+        len[i] = run[i].length;
+        out[i] = digests[i];
+      }
+      invokeMany<bswap>(opts.algot, opts.seed, in, len, run.size(), out, opts.size, opts.rounds);
+    }
+    for (size_t i = 0; i < run.size(); i++) {
+      conn.reply(run[i].id, 0, digests[i], digest_len);
+    }
+}
+
+// --serve: answer requests on stdin/stdout, or on every connection to the
+// Unix socket at socket_path, each on a thread of its own. At most
+// SERVE_MAX_CONNECTIONS are served at once, later ones wait in the listen
+// backlog until one closes. Tree requests share opts.pool. Only returns for
+// stdin/stdout, once the input ends.
+int serveRequests(const HashOptions& opts, const std::string& socket_path) {
+    auto answer = [&opts](const std::vector<rainserve::Request>& run, rainserve::Connection& conn) {
+      answerRequests(opts, run, conn);
+    };
+    if (socket_path == "-") {
+      // a client that closes its end stops the server with an error, not SIGPIPE
+      signal(SIGPIPE, SIG_IGN);
+      rainserve::Connection conn(STDIN_FILENO, STDOUT_FILENO);
+      try {
+        rainserve::serve(conn, answer);
+      } catch (const std::exception& e) {
+        std::cerr << "rainsum: " << e.what() << '\n';
+        return 1;
+      }
+      return 0;
+    }
+
+    int listener;
+    try {
+      listener = rainserve::listenUnix(socket_path);
+    } catch (const std::exception& e) {
+      std::cerr << "rainsum: " << e.what() << '\n';
+      return 1;
+    }
+    // live connections, static so the detached threads can always reach them
+    static std::mutex live_mutex;
+    static std::condition_variable live_changed;
+    static size_t live = 0;
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(live_mutex);
+        live_changed.wait(lock, [] { return live < rainserve::SERVE_MAX_CONNECTIONS; });
+      }
+      int fd = accept(listener, nullptr, nullptr);
+      if (fd < 0) {
+        if (errno == EINTR || errno == ECONNABORTED) {
+          continue;
         }
+        throw std::runtime_error(std::string("accept failed: ") + std::strerror(errno));
+      }
+      auto closed = [fd] {
+        close(fd);
+        std::lock_guard<std::mutex> lock(live_mutex);
+        live--;
+        live_changed.notify_one();
+      };
+      {
+        std::lock_guard<std::mutex> lock(live_mutex);
+        live++;
+      }
+      try {
+        std::thread([fd, answer, closed] {
+          try {
+            rainserve::Connection conn(fd, fd);
+            rainserve::serve(conn, answer);
+          } catch (const std::exception& e) {
+            std::cerr << "rainsum: " << e.what() << '\n';
+          }
+          closed();
+        }).detach();
+      } catch (const std::system_error& e) {
+        // out of threads: drop this client rather than the server
+        std::cerr << "rainsum: " << e.what() << '\n';
+        closed();
+      }
     }
 }
+#endif
+
+#ifdef USE_FILESYSTEM
+// Merkle root of a walked directory. The files are sorted by their path
+// relative to root, with '/' separators, and each one becomes a record of the
+// 64-bit little-endian path length, the path and the file's digest. The
+// records are hashed in tree mode, so the root is the --tree digest of that
+// listing and changes when any file is added, removed, renamed or modified.
+void digestListing(const HashOptions& opts, const std::string& root, std::vector<std::pair<std::string, Digest>>& files, Digest& digest) {
+    for (auto& file : files) {
+      file.first = std::filesystem::path(file.first).lexically_relative(root).generic_string();
+    }
+    std::sort(files.begin(), files.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+    std::vector<uint8_t> listing;
+    for (const auto& file : files) {
+      size_t at = listing.size();
+      listing.resize(at + 8 + file.first.size() + file.second.size());
+      PUT_U64<bswap>(file.first.size(), listing.data(), at);
+      std::memcpy(listing.data() + at + 8, file.first.data(), file.first.size());
+      std::memcpy(listing.data() + at + 8 + file.first.size(), file.second.data(), file.second.size());
+    }
+    digest.resize(opts.size / 8);
+    invokeTree<bswap>(opts.algot, opts.seed, listing.data(), listing.size(), digest.data(), opts.size, opts.pool, opts.rounds);
+}
+#endif
 
 int main(int argc, char** argv) {
   try {
@@ -159,14 +809,38 @@ int main(int argc, char** argv) {
     auto seed_option = cxxopts::value<std::string>()->default_value("0");
 
     options.add_options()
-      ("m,mode", "Mode: digest or stream", cxxopts::value<Mode>()->default_value("digest"))
+      ("m,mode", "Mode: digest, stream, xof or keystream", cxxopts::value<Mode>()->default_value("digest"))
       ("v,version", "Print version")
       ("a,algorithm", "Specify the hash algorithm to use", cxxopts::value<std::string>()->default_value("bow"))
       ("s,size", "Specify the size of the hash", cxxopts::value<uint32_t>()->default_value("256"))
       ("o,output-file", "Output file for the hash", cxxopts::value<std::string>()->default_value("/dev/stdout"))
       ("t,test-vectors", "Calculate the hash of the standard test vectors", cxxopts::value<bool>()->default_value("false"))
       ("l,output-length", "Output length in hashes", cxxopts::value<uint64_t>()->default_value("1000000"))
+      ("offset", "Byte offset to start xof or keystream output at", cxxopts::value<uint64_t>()->default_value("0"))
       ("seed", "Seed value", seed_option)
+      ("seed-file", "Load named seeds, one \"name value\" line each", cxxopts::value<std::string>())
+      ("no-mmap", "Read files with read() instead of mapping them", cxxopts::value<bool>()->default_value("false"))
+      ("chunks", "Print content-defined chunks and their digests, AVG bytes on average", cxxopts::value<std::string>()->implicit_value("8K"))
+      ("index", "Keep tree leaf digests in this sidecar file and re-hash only changed leaves", cxxopts::value<std::string>())
+      ("dirty", "Byte ranges (OFFSET+LENGTH) changed since the index was written", cxxopts::value<std::vector<std::string>>())
+      ("block-size", "Read files this many bytes at a time (K, M, G suffixes)", cxxopts::value<std::string>())
+      ("direct", "Read files with O_DIRECT, bypassing the page cache", cxxopts::value<bool>()->default_value("false"))
+      ("r,recursive", "Hash every regular file under the DIR arguments", cxxopts::value<bool>()->default_value("false"))
+      ("merkle", "With -r, print one root digest per directory instead of a line per file", cxxopts::value<bool>()->default_value("false"))
+      ("serve", "Answer hash requests on stdin/stdout, or on the Unix socket SOCKET", cxxopts::value<std::string>()->implicit_value("-"))
+      ("files-from", "Read the list of files to hash from FILE (- for stdin)", cxxopts::value<std::string>())
+      ("0,null", "File list entries are NUL-separated", cxxopts::value<bool>()->default_value("false"))
+      ("j,threads", "Worker threads for batch hashing and tree leaves", cxxopts::value<unsigned>()->default_value("0"))
+      ("cpu-list", "Pin worker threads to these CPUs, like 0-7,16-23", cxxopts::value<std::string>())
+      ("tree", "Hash in tree mode, with leaves hashed in parallel", cxxopts::value<bool>()->default_value("false"))
+      ("isa", "Hash kernels to run: scalar, avx2, avx512 or neon. Default: RAIN_ISA, else the best the CPU has", cxxopts::value<std::string>())
+      ("rounds", "Rainstorm rounds per block: 2, 4, 6 or 8", cxxopts::value<int>()->default_value(std::to_string(rainstorm::ROUNDS)))
+      ("c,check", "Verify the files listed in a MANIFEST of hash and path lines", cxxopts::value<std::string>())
+      ("fail-fast", "Stop verifying at the first mismatch", cxxopts::value<bool>()->default_value("false"))
+      ("base64", "Print digests in base64", cxxopts::value<bool>()->default_value("false"))
+      ("binary-output", "Write bare binary digests", cxxopts::value<bool>()->default_value("false"))
+      ("stats", "Print run statistics to stderr", cxxopts::value<bool>()->default_value("false"))
+      ("stats-json", "Print run statistics to stderr as JSON", cxxopts::value<bool>()->default_value("false"))
       ("h,help", "Print usage");
 
     auto result = options.parse(argc, argv);
@@ -180,12 +854,28 @@ int main(int argc, char** argv) {
       return 0;
     }
 
+    // before anything is hashed, so every kernel is picked for this ISA
+    if (result.count("isa")) {
+      rainisa::Isa isa = rainisa::parse(result["isa"].as<std::string>());
+      if (!rainisa::select(isa)) {
+        std::cerr << "rain: " << rainisa::fallbackMessage(isa, rainisa::active()) << '\n';
+      }
+    } else {
+      rainisa::active();
+      if (!rainisa::environmentProblem().empty()) {
+        std::cerr << "rain: RAIN_ISA: " << rainisa::environmentProblem() << '\n';
+      }
+    }
+
     std::string seed_str = result["seed"].as<std::string>();
     uint64_t seed;
-    // If the seed_str can be converted to uint64_t, use it as a number; otherwise, hash it (with rainstorm, seed 0, 64-bit)
-    if (!(std::istringstream(seed_str) >> seed)) {
-        seed = hash_string_to_64_bit(seed_str);
+    // A name from --seed-file, else a number, else the string hashed (with rainstorm, seed 0, 64-bit)
+    std::unordered_map<std::string, uint64_t> named_seeds;
+    if (result.count("seed-file")) {
+      named_seeds = loadSeedFile(result["seed-file"].as<std::string>());
     }
+    auto named = named_seeds.find(seed_str);
+    seed = named != named_seeds.end() ? named->second : parseSeed(seed_str);
     //std::cout << "Seed : " << seed << std::endl;
 
     Mode mode = result["mode"].as<Mode>();
@@ -201,6 +891,15 @@ int main(int argc, char** argv) {
     HashAlgorithm algot = getHashAlgorithm(algorithm);
 
     uint32_t size = result["size"].as<uint32_t>();
+    if (algot == HashAlgorithm::Unknown) {
+      std::cerr << "Error: unknown algorithm " << algorithm << ", expected rainbow or rainstorm.\n";
+      return 1;
+    }
+    // --check takes each size from the manifest and --serve from each request
+    if (!result.count("check") && !result.count("serve") && !validHashSize(algot, size)) {
+      std::cerr << "Error: invalid size " << size << " for " << hashAlgoToString(algot) << ".\n";
+      return 1;
+    }
     bool use_test_vectors = result["test-vectors"].as<bool>();
 
     uint64_t output_length = result["output-length"].as<uint64_t>();
@@ -211,42 +910,335 @@ int main(int argc, char** argv) {
       output_length *= size;
     }
 
-    std::string inpath;
+    std::string outpath = result["output-file"].as<std::string>();
 
-    // Check if unmatched arguments exist (indicating there was a filename provided)
-    if(!result.unmatched().empty()) {
-      inpath = result.unmatched().front();
-    } else {
-      // No filename provided, read from stdin
+    HashOptions opts;
+    opts.algot = algot;
+    opts.size = size;
+    opts.seed = seed;
+    if (result.count("block-size")) {
+      opts.block_size = parseBlockSize(result["block-size"].as<std::string>());
+    }
+    opts.direct = result["direct"].as<bool>();
+    opts.use_mmap = !result["no-mmap"].as<bool>() && !opts.direct;
+    opts.tree = result["tree"].as<bool>();
+    opts.rounds = result["rounds"].as<int>();
+    if (opts.rounds != rainstorm::ROUNDS) {
+      if (algot != HashAlgorithm::Rainstorm) {
+        std::cerr << "Error: --rounds only applies to Rainstorm (-a storm).\n";
+        return 1;
+      }
+      // the XOF, keystream, index and server formats are defined at the default round count
+      if (mode == Mode::Xof || mode == Mode::Keystream || result.count("index") || result.count("serve")) {
+        std::cerr << "Error: --rounds does not apply to xof or keystream modes, --index or --serve.\n";
+        return 1;
+      }
+      withRounds(opts.rounds, [](auto) {});
     }
 
-    std::string outpath = result["output-file"].as<std::string>();
+    bool base64 = result["base64"].as<bool>();
+    bool binary = result["binary-output"].as<bool>();
+    if (base64 && binary) {
+      std::cerr << "Error: --base64 and --binary-output cannot be combined.\n";
+      return 1;
+    }
+    if ((base64 || binary) && mode != Mode::Digest) {
+      std::cerr << "Error: --base64 and --binary-output only apply to digest mode.\n";
+      return 1;
+    }
+    opts.offset = result["offset"].as<uint64_t>();
+    if (opts.offset && mode != Mode::Xof && mode != Mode::Keystream) {
+      std::cerr << "Error: --offset only applies to xof and keystream modes.\n";
+      return 1;
+    }
+    opts.format = base64 ? DigestFormat::Base64 : binary ? DigestFormat::Binary : DigestFormat::Hex;
 
-    if (outpath == "/dev/stdout") {
-      if (mode == Mode::Digest) {
-        hashAnything(Mode::Digest, algot, inpath, std::cout, size, use_test_vectors, seed, size / 8);
-      } else {
-        hashAnything(Mode::Stream, algot, inpath, std::cout, size, use_test_vectors, seed, output_length);
+    if (result.count("index")) {
+#ifdef _WIN32
+      std::cerr << "Error: --index is not supported on this platform.\n";
+      return 1;
+#endif
+      if (!opts.tree || mode != Mode::Digest || use_test_vectors) {
+        std::cerr << "Error: --index needs --tree and digest mode, as it stores tree leaf digests.\n";
+        return 1;
       }
-    } else {
-      std::ofstream outfile(outpath, std::ios::binary);
+      opts.index = result["index"].as<std::string>();
+    }
+    if (result.count("dirty")) {
+      if (opts.index.empty()) {
+        std::cerr << "Error: --dirty only applies with --index.\n";
+        return 1;
+      }
+      for (const auto& range : result["dirty"].as<std::vector<std::string>>()) {
+        size_t plus = range.find('+');
+        if (plus == std::string::npos) {
+          std::cerr << "Error: --dirty ranges are OFFSET+LENGTH: " << range << "\n";
+          return 1;
+        }
+        opts.dirty.emplace_back(parseByteCount(range.substr(0, plus), "dirty offset"), parseByteCount(range.substr(plus + 1), "dirty length"));
+      }
+    }
+    if (result.count("chunks")) {
+      if (mode != Mode::Digest || opts.tree || use_test_vectors) {
+        std::cerr << "Error: --chunks only applies to digest mode, without --tree or --test-vectors.\n";
+        return 1;
+      }
+      opts.chunk_avg = parseByteCount(result["chunks"].as<std::string>(), "chunk size");
+      // rejects sizes out of range before any input is read
+      raincdc::Params::forAverage(opts.chunk_avg);
+    }
+
+    bool stats_json = result["stats-json"].as<bool>();
+    std::unique_ptr<RunStats> stats;
+    if (result["stats"].as<bool>() || stats_json) {
+#ifdef RAIN_NO_STATS
+      std::cerr << "Error: this rainsum was built with RAIN_NO_STATS, so --stats is not available.\n";
+      return 1;
+#endif
+      stats = std::make_unique<RunStats>(rainisa::name(rainisa::active()));
+      opts.stats = stats.get();
+    }
+
+    if (result.count("cpu-list")) {
+      opts.cpus = rainnuma::parseCpuList(result["cpu-list"].as<std::string>());
+      std::vector<unsigned> allowed = rainnuma::allowedCpus();
+      for (unsigned cpu : opts.cpus) {
+        if (!allowed.empty() && std::find(allowed.begin(), allowed.end(), cpu) == allowed.end()) {
+          std::cerr << "Error: CPU " << cpu << " in --cpu-list is not one this process can run on.\n";
+          return 1;
+        }
+      }
+    }
+
+    // with a CPU list, one worker per listed CPU unless -j says otherwise
+    unsigned threads = result["threads"].as<unsigned>();
+    if (threads == 0) {
+      threads = opts.cpus.empty() ? std::max(1u, std::thread::hardware_concurrency()) : static_cast<unsigned>(opts.cpus.size());
+    }
+
+    std::ofstream outfile;
+    std::ostream* outstream = &std::cout;
+    if (outpath != "/dev/stdout") {
+      outfile.open(outpath, std::ios::binary);
       if (!outfile.is_open()) {
         std::cerr << "Failed to open output file: " << outpath << std::endl;
         return 1;
       }
+      outstream = &outfile;
+    }
+
+    // Unmatched arguments are the files to hash, with no file we read stdin
+    const auto& files = result.unmatched();
+
+    bool checking = result.count("check") > 0;
+    if (result.count("serve")) {
+#ifdef _WIN32
+      std::cerr << "Error: --serve is not supported on this platform.\n";
+      return 1;
+#else
+      if (!files.empty() || checking || result.count("files-from") || result["recursive"].as<bool>() || use_test_vectors || stats ||
+          mode != Mode::Digest || opts.chunk_avg || !opts.index.empty()) {
+        std::cerr << "Error: --serve takes its inputs from requests, not files, and only hashes digests.\n";
+        return 1;
+      }
+      std::unique_ptr<WorkPool> serve_pool;
+      if (threads > 1) {
+        serve_pool = std::make_unique<WorkPool>(threads, opts.cpus);
+        opts.pool = serve_pool.get();
+      }
+      return serveRequests(opts, result["serve"].as<std::string>());
+#endif
+    }
+    bool merkle = result["merkle"].as<bool>();
+    if (merkle && !result["recursive"].as<bool>()) {
+      std::cerr << "Error: --merkle only applies with -r.\n";
+      return 1;
+    }
+    if (result["recursive"].as<bool>()) {
+#ifndef USE_FILESYSTEM
+      std::cerr << "Error: this rainsum was built without USE_FILESYSTEM, so -r is not available.\n";
+      return 1;
+#else
+      if (mode != Mode::Digest || use_test_vectors || opts.chunk_avg || !opts.index.empty() || checking || result.count("files-from")) {
+        std::cerr << "Error: -r only applies to digest mode, without --chunks, --index, --check or --files-from.\n";
+        return 1;
+      }
+      if (files.empty()) {
+        std::cerr << "Error: -r needs at least one DIR to hash.\n";
+        return 1;
+      }
 
-      if (mode == Mode::Digest) {
-        hashAnything(Mode::Digest, algot, inpath, outfile, size, use_test_vectors, seed, size / 8);
+      // One walk per argument. Arguments that are not directories are hashed as they are.
+      std::unique_ptr<DirectoryWalker> walker;
+      uint64_t walk_errors = 0;
+      auto walk = [&](const std::string& root) {
+        std::error_code ec;
+        bool is_dir = std::filesystem::is_directory(root, ec);
+        bool pending = !is_dir;
+        if (is_dir) {
+          walker = std::make_unique<DirectoryWalker>(root, threads);
+        }
+        return [&, root, pending](BatchEntry& entry) mutable {
+          entry = BatchEntry();
+          if (pending) {
+            pending = false;
+            entry.path = root;
+            return true;
+          }
+          uint64_t size;
+          if (walker && walker->next(entry.path, size)) {
+            entry.file_size = size;
+            return true;
+          }
+          if (walker) {
+            walk_errors += walker->errors();
+            walker.reset();
+          }
+          return false;
+        };
+      };
+
+      BatchTotals totals;
+      bool fail_fast = result["fail-fast"].as<bool>();
+      int status = 0;
+      if (merkle) {
+        std::unique_ptr<WorkPool> listing_pool;
+        if (threads > 1) {
+          listing_pool = std::make_unique<WorkPool>(threads, opts.cpus);
+        }
+        for (const auto& root : files) {
+          std::vector<std::pair<std::string, Digest>> collected;
+          uint64_t errors_before = walk_errors;
+          int root_status = hashBatch(opts, walk(root), *outstream, threads, fail_fast, totals, &collected);
+          // a root that skipped a file would look like a valid fingerprint of a different tree
+          if (root_status != 0 || walk_errors != errors_before) {
+            std::cerr << "rainsum: " << root << ": not every file could be hashed, no root printed\n";
+            status = 1;
+            continue;
+          }
+          Digest digest;
+          HashOptions listing_opts = opts;
+          listing_opts.pool = listing_pool.get();
+          digestListing(listing_opts, root, collected, digest);
+          writeDigest(mode, opts, digest, output_length, *outstream, root);
+        }
       } else {
-        hashAnything(Mode::Stream, algot, inpath, outfile, size, use_test_vectors, seed, output_length);
+        size_t next_root = 0;
+        std::function<bool(BatchEntry&)> current = [](BatchEntry&) { return false; };
+        auto next_entry = [&](BatchEntry& entry) {
+          while (!current(entry)) {
+            if (next_root == files.size()) {
+              return false;
+            }
+            current = walk(files[next_root++]);
+          }
+          return true;
+        };
+        status = hashBatch(opts, next_entry, *outstream, threads, fail_fast, totals);
+      }
+      if (walk_errors) {
+        status = 1;
+      }
+      if (stats) {
+        outstream->flush();
+        stats->report(std::cerr, stats_json);
+      }
+      return status;
+#endif
+    }
+    if (files.size() > 1 || result.count("files-from") || checking) {
+      if (mode != Mode::Digest || use_test_vectors || opts.chunk_avg || !opts.index.empty()) {
+        std::cerr << "Error: multiple files can only be hashed in digest mode, without --chunks or --index.\n";
+        return 1;
       }
 
-      outfile.close();
+      std::string list_path = checking ? result["check"].as<std::string>() :
+        result.count("files-from") ? result["files-from"].as<std::string>() : "";
+      std::ifstream list_file;
+      std::istream* list = nullptr;
+      if (list_path == "-") {
+        list = &getInputStream();
+      } else if (!list_path.empty()) {
+        list_file.open(list_path);
+        if (!list_file.is_open()) {
+          std::cerr << "Failed to open file list: " << list_path << std::endl;
+          return 1;
+        }
+        list = &list_file;
+      }
+      char delim = result["null"].as<bool>() ? '\0' : '\n';
+
+      size_t next_file = 0;
+      uint64_t bad_lines = 0;
+      std::string line;
+      auto next_entry = [&](BatchEntry& entry) {
+        if (!checking && next_file < files.size()) {
+          entry.path = files[next_file++];
+          return true;
+        }
+        while (list && std::getline(*list, line, delim)) {
+          if (line.empty()) {
+            continue;
+          }
+          if (!checking) {
+            entry.path = line;
+            return true;
+          }
+          // The digest length tells us the hash size each entry was made with
+          if (parseManifestLine(line, entry) && validHashSize(algot, entry.expected.size() * 4)) {
+            entry.size = entry.expected.size() * 4;
+            return true;
+          }
+          bad_lines++;
+        }
+        return false;
+      };
+
+      BatchTotals totals;
+      auto start = std::chrono::steady_clock::now();
+      int status = hashBatch(opts, next_entry, *outstream, threads, result["fail-fast"].as<bool>(), totals);
+      std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+      if (checking) {
+        outstream->flush();
+        double gib = totals.bytes / double(1 << 30);
+        std::cerr << "rainsum: checked " << totals.files << " files, " << std::fixed << std::setprecision(2)
+                  << gib << " GiB in " << elapsed.count() << " s (" << gib / std::max(elapsed.count(), 1e-9) << " GiB/s)\n";
+        if (bad_lines) {
+          std::cerr << "rainsum: WARNING: " << bad_lines << " line(s) are improperly formatted\n";
+          status = 1;
+        }
+        if (totals.unreadable) {
+          std::cerr << "rainsum: WARNING: " << totals.unreadable << " listed file(s) could not be read\n";
+        }
+        if (totals.mismatched) {
+          std::cerr << "rainsum: WARNING: " << totals.mismatched << " computed checksum(s) did NOT match\n";
+        }
+      }
+      if (stats) {
+        outstream->flush();
+        stats->report(std::cerr, stats_json);
+      }
+      return status;
     }
 
+    std::string inpath = files.empty() ? "" : files.front();
+    std::unique_ptr<WorkPool> leaf_pool;
+    bool seekable = mode == Mode::Xof || mode == Mode::Keystream;
+    if ((opts.tree || seekable) && threads > 1) {
+      leaf_pool = std::make_unique<WorkPool>(threads, opts.cpus);
+      opts.pool = leaf_pool.get();
+    }
+    hashAnything(mode, opts, inpath, *outstream, use_test_vectors, output_length);
+
+    if (stats) {
+      outstream->flush();
+      stats->report(std::cerr, stats_json);
+    }
     return 0;
-  } catch (const std::runtime_error& e) {
+  } catch (const std::exception& e) {
     std::cerr << "An error occurred: " << e.what() << std::endl;
+    return 1;
   }
 }
 
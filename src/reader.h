@@ -0,0 +1,446 @@
+#pragma once
+
+// Pipelined file reader
+// Keeps PIPELINE_DEPTH reads of PIPELINE_BLOCK bytes in flight ahead of the
+// caller, so the disk is reading the next blocks while the current one is
+// hashed. On Linux the reads go through io_uring (raw syscalls, no liburing),
+// elsewhere, or when the kernel refuses io_uring, a reader thread issues
+// pread()s into the same ring of buffers.
+//
+// With direct, the file is opened with O_DIRECT so a cold scan does not fill
+// the page cache. Filesystems that refuse O_DIRECT get a buffered read, and the
+// pages are dropped with POSIX_FADV_DONTNEED as each block is consumed.
+// Building with -DRAIN_NO_IO_URING always uses the reader thread.
+//
+// A thread that reads many files hands each reader the same ReadBuffers, so
+// the blocks are allocated for its first large file and reused after that.
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && !defined(RAIN_NO_IO_URING) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#define RAIN_HAVE_IO_URING 1
+#endif
+
+constexpr size_t PIPELINE_BLOCK = 1 << 20;
+constexpr size_t PIPELINE_DEPTH = 4;
+constexpr size_t DIRECT_ALIGN = 4096;
+
+#ifndef _WIN32
+// PIPELINE_DEPTH aligned blocks that grow to the largest block size asked for
+class ReadBuffers {
+  public:
+    uint8_t* block(size_t i, size_t size) {
+      if (size > block_size) {
+        for (auto& block : blocks) {
+          block.reset();
+        }
+        block_size = size;
+      }
+      if (!blocks[i]) {
+        blocks[i].reset(static_cast<uint8_t*>(std::aligned_alloc(DIRECT_ALIGN, block_size)));
+        if (!blocks[i]) {
+          throw std::bad_alloc();
+        }
+      }
+      return blocks[i].get();
+    }
+
+  private:
+    struct FreeBuffer {
+      void operator()(uint8_t* p) const {
+        std::free(p);
+      }
+    };
+
+    std::array<std::unique_ptr<uint8_t, FreeBuffer>, PIPELINE_DEPTH> blocks;
+    size_t block_size = 0;
+};
+
+// path must outlive the reader, it is kept for error messages. Without
+// buffers of the caller's, the reader allocates its own.
+class PipelinedReader {
+  public:
+    PipelinedReader(const std::string& path, bool direct, size_t block_size = PIPELINE_BLOCK, ReadBuffers* buffers = nullptr)
+      : name(path), block_size((block_size + DIRECT_ALIGN - 1) / DIRECT_ALIGN * DIRECT_ALIGN) {
+      if (direct) {
+#ifdef O_DIRECT
+        file.fd = open(path.c_str(), O_RDONLY | O_DIRECT);
+#endif
+        drop_cache = file.fd < 0;
+      }
+      if (file.fd < 0) {
+        file.fd = open(path.c_str(), O_RDONLY);
+      }
+      struct stat st;
+      if (file.fd < 0 || fstat(file.fd, &st) != 0) {
+        throw std::runtime_error("Cannot open file for reading: " + path);
+      }
+      length = st.st_size;
+
+      ReadBuffers& blocks = buffers ? *buffers : own_blocks;
+      for (size_t i = 0; i < slots.size(); i++) {
+        slots[i].data = blocks.block(i, this->block_size);
+      }
+#ifdef RAIN_HAVE_IO_URING
+      uring = setupRing();
+#endif
+      if (uring) {
+        for (size_t i = 0; i < slots.size(); i++) {
+          submitNext(i);
+        }
+      } else {
+        reader = std::thread([this] { readAhead(); });
+      }
+    }
+
+    ~PipelinedReader() {
+      if (reader.joinable()) {
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          stopping = true;
+        }
+        changed.notify_all();
+        reader.join();
+      }
+#ifdef RAIN_HAVE_IO_URING
+      if (uring) {
+        // Reap reads still in flight before their buffers go away
+        try {
+          while (in_flight > 0) {
+            reap();
+          }
+        } catch (const std::exception&) {
+        }
+        teardownRing();
+      }
+#endif
+    }
+
+    PipelinedReader(const PipelinedReader&) = delete;
+    PipelinedReader& operator=(const PipelinedReader&) = delete;
+
+    uint64_t size() const {
+      return length;
+    }
+
+    // True when the reads go through io_uring, false for the reader thread
+    bool usesRing() const {
+      return uring;
+    }
+
+    // The next block of the file, valid until the following call. Returns 0 at the end.
+    size_t next(const uint8_t** data) {
+      release();
+      if (consumed >= length) {
+        return 0;
+      }
+      Slot& slot = slots[current % slots.size()];
+      if (uring) {
+#ifdef RAIN_HAVE_IO_URING
+        while (!slot.ready) {
+          reap();
+        }
+#endif
+      } else {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [&] { return slot.ready; });
+      }
+      if (slot.error) {
+        throw std::runtime_error("Input file could not be read: " + name + ": " + std::strerror(slot.error));
+      }
+      holding = true;
+      *data = slot.data;
+      consumed += slot.len;
+      return slot.len;
+    }
+
+    // read()-style access for code that wants its own buffer
+    size_t read(uint8_t* dst, size_t max) {
+      size_t got = 0;
+      while (got < max) {
+        if (pending_len == 0) {
+          pending_len = next(&pending);
+          if (pending_len == 0) {
+            break;
+          }
+        }
+        size_t take = std::min(max - got, pending_len);
+        std::memcpy(dst + got, pending, take);
+        pending += take;
+        pending_len -= take;
+        got += take;
+      }
+      return got;
+    }
+
+  private:
+    // The descriptor and the blocks release themselves, so a constructor
+    // that throws partway through leaks neither
+    struct FileDescriptor {
+      int fd = -1;
+      FileDescriptor() = default;
+      FileDescriptor(const FileDescriptor&) = delete;
+      FileDescriptor& operator=(const FileDescriptor&) = delete;
+      ~FileDescriptor() {
+        if (fd >= 0) {
+          close(fd);
+        }
+      }
+    };
+
+    struct Slot {
+      uint8_t* data = nullptr;
+      uint64_t offset = 0;
+      size_t len = 0;
+      int error = 0;
+      bool ready = false;
+    };
+
+    // Hand the block we returned last back to the ring
+    void release() {
+      if (!holding) {
+        return;
+      }
+      holding = false;
+      size_t index = current % slots.size();
+      Slot& slot = slots[index];
+      if (drop_cache) {
+        posix_fadvise(file.fd, slot.offset, slot.len, POSIX_FADV_DONTNEED);
+      }
+      current++;
+      if (uring) {
+        slot.ready = false;
+        submitNext(index);
+      } else {
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          slot.ready = false;
+        }
+        changed.notify_all();
+      }
+    }
+
+    // Blocking read of one whole block (or the tail of the file), retrying short reads.
+    // Requests are whole aligned blocks, as O_DIRECT needs, and come back short at the end.
+    int fill(Slot& slot) {
+      size_t want = std::min<uint64_t>(block_size, length - slot.offset);
+      size_t got = 0;
+      while (got < want) {
+        ssize_t n = pread(file.fd, slot.data + got, block_size - got, slot.offset + got);
+        if (n < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+          return errno;
+        }
+        if (n == 0) {
+          break;
+        }
+        got += n;
+      }
+      slot.len = got;
+      return 0;
+    }
+
+    // Reader thread: fill slots in file order as they come free
+    void readAhead() {
+      for (uint64_t block = 0; block * block_size < length; block++) {
+        Slot& slot = slots[block % slots.size()];
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          changed.wait(lock, [&] { return !slot.ready || stopping; });
+          if (stopping) {
+            return;
+          }
+        }
+        slot.offset = block * block_size;
+        int error = fill(slot);
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          slot.error = error;
+          slot.ready = true;
+        }
+        changed.notify_all();
+        if (error) {
+          return;
+        }
+      }
+    }
+
+#ifdef RAIN_HAVE_IO_URING
+    bool setupRing() {
+      struct io_uring_params params;
+      std::memset(&params, 0, sizeof(params));
+      ring_fd = syscall(__NR_io_uring_setup, static_cast<unsigned>(slots.size()), &params);
+      if (ring_fd < 0) {
+        return false;
+      }
+      sq_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+      cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+      if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        sq_size = cq_size = std::max(sq_size, cq_size);
+      }
+      sq_ring = mmap(nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+      cq_ring = (params.features & IORING_FEAT_SINGLE_MMAP) ? sq_ring :
+        mmap(nullptr, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+      sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+      void* sqes_map = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+      if (sq_ring == MAP_FAILED || cq_ring == MAP_FAILED || sqes_map == MAP_FAILED) {
+        if (sqes_map != MAP_FAILED) {
+          munmap(sqes_map, sqes_size);
+        }
+        sqes = nullptr;
+        teardownRing();
+        return false;
+      }
+      uint8_t* sq = static_cast<uint8_t*>(sq_ring);
+      uint8_t* cq = static_cast<uint8_t*>(cq_ring);
+      sq_tail = reinterpret_cast<uint32_t*>(sq + params.sq_off.tail);
+      sq_mask = *reinterpret_cast<uint32_t*>(sq + params.sq_off.ring_mask);
+      sq_array = reinterpret_cast<uint32_t*>(sq + params.sq_off.array);
+      cq_head = reinterpret_cast<uint32_t*>(cq + params.cq_off.head);
+      cq_tail = reinterpret_cast<uint32_t*>(cq + params.cq_off.tail);
+      cq_mask = *reinterpret_cast<uint32_t*>(cq + params.cq_off.ring_mask);
+      cqes = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+      sqes = static_cast<struct io_uring_sqe*>(sqes_map);
+      return true;
+    }
+
+    void teardownRing() {
+      if (sqes) {
+        munmap(sqes, sqes_size);
+      }
+      if (cq_ring && cq_ring != MAP_FAILED && cq_ring != sq_ring) {
+        munmap(cq_ring, cq_size);
+      }
+      if (sq_ring && sq_ring != MAP_FAILED) {
+        munmap(sq_ring, sq_size);
+      }
+      close(ring_fd);
+    }
+
+    // Wait for one completion and mark its slot
+    void reap() {
+      uint32_t head = *cq_head;
+      while (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+        if (syscall(__NR_io_uring_enter, ring_fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && errno != EINTR) {
+          throw std::runtime_error(std::string("io_uring wait failed: ") + std::strerror(errno));
+        }
+      }
+      struct io_uring_cqe* cqe = &cqes[head & cq_mask];
+      Slot& slot = slots[cqe->user_data];
+      int res = cqe->res;
+      __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+      in_flight--;
+
+      // Regular files only come up short at the end. Anything else, including
+      // kernels without IORING_OP_READ, is redone with pread, which reports real errors.
+      size_t want = std::min<uint64_t>(block_size, length - slot.offset);
+      if (res < 0 || static_cast<size_t>(res) < want) {
+        slot.error = fill(slot);
+      } else {
+        slot.len = want;
+      }
+      slot.ready = true;
+    }
+#endif
+
+    // Queue the read for the next unread block into slot index
+    void submitNext(size_t index) {
+#ifdef RAIN_HAVE_IO_URING
+      if (submitted * block_size >= length) {
+        return;
+      }
+      Slot& slot = slots[index];
+      slot.offset = submitted * block_size;
+      slot.error = 0;
+      submitted++;
+
+      uint32_t tail = *sq_tail;
+      uint32_t at = tail & sq_mask;
+      struct io_uring_sqe* sqe = &sqes[at];
+      std::memset(sqe, 0, sizeof(*sqe));
+      sqe->opcode = IORING_OP_READ;
+      sqe->fd = file.fd;
+      sqe->addr = reinterpret_cast<uint64_t>(slot.data);
+      sqe->len = static_cast<uint32_t>(block_size);
+      sqe->off = slot.offset;
+      sqe->user_data = index;
+      sq_array[at] = at;
+      __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+      if (syscall(__NR_io_uring_enter, ring_fd, 1, 0, 0, nullptr, 0) < 0) {
+        // Run it ourselves rather than fail the whole file
+        __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+        slot.error = fill(slot);
+        slot.ready = true;
+        return;
+      }
+      in_flight++;
+#else
+      (void)index;
+#endif
+    }
+
+    const std::string& name;
+    FileDescriptor file;
+    bool drop_cache = false;
+    uint64_t length = 0;
+    size_t block_size;
+    ReadBuffers own_blocks;
+    std::array<Slot, PIPELINE_DEPTH> slots;
+    uint64_t current = 0;           // block the caller is on
+    uint64_t consumed = 0;
+    bool holding = false;
+    const uint8_t* pending = nullptr;
+    size_t pending_len = 0;
+
+    // reader thread backend
+    std::thread reader;
+    std::mutex mutex;
+    std::condition_variable changed;
+    bool stopping = false;
+
+    // io_uring backend
+    bool uring = false;
+#ifdef RAIN_HAVE_IO_URING
+    int ring_fd = -1;
+    void* sq_ring = nullptr;
+    void* cq_ring = nullptr;
+    size_t sq_size = 0;
+    size_t cq_size = 0;
+    size_t sqes_size = 0;
+    uint32_t* sq_tail = nullptr;
+    uint32_t* sq_array = nullptr;
+    uint32_t sq_mask = 0;
+    uint32_t* cq_head = nullptr;
+    uint32_t* cq_tail = nullptr;
+    uint32_t cq_mask = 0;
+    struct io_uring_cqe* cqes = nullptr;
+    struct io_uring_sqe* sqes = nullptr;
+    uint64_t submitted = 0;
+    size_t in_flight = 0;
+#endif
+};
+#endif
@@ -0,0 +1,269 @@
+#pragma once
+
+// Server mode for --serve
+// One rainsum process answers a stream of hash requests, on stdin/stdout or
+// on each connection to a Unix socket, so callers pay for process startup once
+// rather than per hash. Requests may be pipelined: clients can send any number
+// before reading, and responses come back in request order.
+//
+// All integers are little-endian. A request is a 32-byte header and a payload:
+//
+//   u8  op          0: hash the payload, 1: hash the file whose path is the payload
+//   u8  algorithm   0: Rainbow, 1: Rainstorm
+//   u16 bits        digest size
+//   u32 flags       bit 0: tree mode
+//   u64 seed
+//   u64 id          echoed in the response
+//   u64 length      payload bytes, at most SERVE_MAX_PAYLOAD
+//
+// A response is a 16-byte header and a body:
+//
+//   u64 id
+//   u32 status      0: the body is the digest, 1: the body is an error message
+//   u32 length      body bytes
+//
+// A request the server cannot act on (unknown algorithm, unreadable file) gets
+// an error response and the stream goes on. A header that cannot be framed (a
+// payload over the limit, input ending inside a request) closes the stream.
+//
+// Input is read in large blocks and every request already in the buffer is
+// answered before the next read, so a pipelined burst costs one read and one
+// write. Consecutive payload requests with the same parameters are handed
+// over together, up to SERVE_BATCH at a time, which lets Rainstorm hash them
+// in the multi-buffer kernels.
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "common.h"
+
+namespace rainserve {
+  constexpr size_t   REQUEST_HEADER    = 32;
+  constexpr size_t   RESPONSE_HEADER   = 16;
+  constexpr uint64_t SERVE_MAX_PAYLOAD = 1 << 30;
+  constexpr size_t   SERVE_BUFFER      = 1 << 20;     // read size, and how much output builds up before a write
+  constexpr size_t   SERVE_BATCH       = 8;           // one full set of multi-buffer lanes
+  constexpr size_t   SERVE_MAX_CONNECTIONS = 64;      // live socket connections, each on a thread; more wait in the backlog
+
+  enum Op : uint8_t {
+    HashPayload = 0,
+    HashFile    = 1
+  };
+
+  constexpr uint32_t FLAG_TREE = 1;
+
+  struct Request {
+    uint8_t  op;
+    uint8_t  algorithm;
+    uint16_t bits;
+    uint32_t flags;
+    uint64_t seed;
+    uint64_t id;
+    const uint8_t* payload;         // valid until the next blocking call to next()
+    size_t   length;
+
+    // whether other can share a batch with this request
+    bool batchesWith(const Request& other) const {
+      return op == HashPayload && other.op == HashPayload && !(flags & FLAG_TREE) && !(other.flags & FLAG_TREE) &&
+             algorithm == other.algorithm && bits == other.bits && seed == other.seed;
+    }
+  };
+
+#ifndef _WIN32
+  class Connection {
+    public:
+      Connection(int in_fd, int out_fd) : in_fd(in_fd), out_fd(out_fd), input(SERVE_BUFFER) {
+        struct stat st;
+        is_socket = fstat(out_fd, &st) == 0 && S_ISSOCK(st.st_mode);
+      }
+
+      // The next request. Without block, returns false unless a whole request
+      // is already buffered, and earlier payload pointers stay valid. A
+      // blocking call first writes out pending responses, and returns false at
+      // a clean end of input.
+      bool next(Request& request, bool block) {
+        while (!buffered()) {
+          if (!block) {
+            return false;
+          }
+          flush();
+          if (!fill()) {
+            if (start != filled) {
+              throw std::runtime_error("input ended inside a request");
+            }
+            return false;
+          }
+        }
+        const uint8_t* header = input.data() + start;
+        request.op = header[0];
+        request.algorithm = header[1];
+        request.bits = header[2] | (header[3] << 8);
+        request.flags = header[4] | (header[5] << 8) | (header[6] << 16) | (static_cast<uint32_t>(header[7]) << 24);
+        request.seed = GET_U64<bswap>(header, 8);
+        request.id = GET_U64<bswap>(header, 16);
+        request.length = GET_U64<bswap>(header, 24);
+        request.payload = header + REQUEST_HEADER;
+        start += REQUEST_HEADER + request.length;
+        return true;
+      }
+
+      void reply(uint64_t id, uint32_t status, const void* body, size_t length) {
+        size_t at = output.size();
+        output.resize(at + RESPONSE_HEADER + length);
+        PUT_U64<bswap>(id, output.data(), at);
+        PUT_U64<bswap>(status | (static_cast<uint64_t>(length) << 32), output.data(), at + 8);
+        std::memcpy(output.data() + at + RESPONSE_HEADER, body, length);
+        if (output.size() >= SERVE_BUFFER) {
+          flush();
+        }
+      }
+
+      void flush() {
+        size_t done = 0;
+        while (done < output.size()) {
+          // MSG_NOSIGNAL: a client that went away ends this stream, not the server
+          ssize_t n = is_socket ? send(out_fd, output.data() + done, output.size() - done, MSG_NOSIGNAL)
+                                : write(out_fd, output.data() + done, output.size() - done);
+          if (n < 0 && errno == EINTR) {
+            continue;
+          }
+          if (n <= 0) {
+            throw std::runtime_error(std::string("write failed: ") + std::strerror(errno));
+          }
+          done += n;
+        }
+        output.clear();
+      }
+
+    private:
+      // Whether a whole request, header and payload, starts at input[start]
+      bool buffered() {
+        if (filled - start < REQUEST_HEADER) {
+          return false;
+        }
+        uint64_t length = GET_U64<bswap>(input.data() + start, 24);
+        if (length > SERVE_MAX_PAYLOAD) {
+          throw std::runtime_error("request payload of " + std::to_string(length) + " bytes is over the limit");
+        }
+        return filled - start >= REQUEST_HEADER + length;
+      }
+
+      // Read more input, making room for the whole of a large request
+      bool fill() {
+        if (start > 0) {
+          std::memmove(input.data(), input.data() + start, filled - start);
+          filled -= start;
+          start = 0;
+        }
+        size_t want = REQUEST_HEADER;
+        if (filled >= REQUEST_HEADER) {
+          want += GET_U64<bswap>(input.data(), 24);
+        }
+        // grow for a large request, and give the memory back after one
+        size_t size = std::max(want, SERVE_BUFFER);
+        if (input.size() != size && (input.size() < want || filled <= SERVE_BUFFER)) {
+          input.resize(std::max(size, filled));
+          input.shrink_to_fit();
+        }
+        while (true) {
+          ssize_t n = read(in_fd, input.data() + filled, input.size() - filled);
+          if (n < 0 && errno == EINTR) {
+            continue;
+          }
+          if (n < 0) {
+            throw std::runtime_error(std::string("read failed: ") + std::strerror(errno));
+          }
+          filled += n;
+          return n > 0;
+        }
+      }
+
+      int in_fd;
+      int out_fd;
+      bool is_socket = false;
+      std::vector<uint8_t> input;
+      size_t start = 0;
+      size_t filled = 0;
+      std::vector<uint8_t> output;
+  };
+
+  // Answer every request on conn, handing answer() runs of requests that
+  // batchesWith() allows to go together. Returns at the end of input.
+  template <typename Answer>
+  static void serve(Connection& conn, Answer answer) {
+    std::vector<Request> run;
+    Request request;
+    while (true) {
+      // only block, which can move the buffer, once every payload taken has been answered
+      if (!conn.next(request, run.empty())) {
+        if (run.empty()) {
+          conn.flush();
+          return;
+        }
+        answer(run, conn);
+        run.clear();
+        continue;
+      }
+      if (!run.empty() && !run.front().batchesWith(request)) {
+        answer(run, conn);
+        run.clear();
+      }
+      run.push_back(request);
+      if (run.size() == SERVE_BATCH || !request.batchesWith(request)) {
+        answer(run, conn);
+        run.clear();
+      }
+    }
+  }
+
+  // Listening socket at path. A stale socket left by an earlier server, one
+  // nothing answers on, is replaced; a live one is an error.
+  static inline int listenUnix(const std::string& path) {
+    sockaddr_un addr{};
+    if (path.size() >= sizeof(addr.sun_path)) {
+      throw std::runtime_error("Socket path is too long: " + path);
+    }
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+      throw std::runtime_error(std::string("Cannot create socket: ") + std::strerror(errno));
+    }
+    struct stat st;
+    if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+      if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0) {
+        close(fd);
+        throw std::runtime_error("Socket " + path + " is already in use by a running server");
+      }
+      // anything but a refusal (no permission, say) leaves the path to bind() to report
+      if (errno == ECONNREFUSED) {
+        unlink(path.c_str());
+      }
+      // a failed connect() leaves the socket unusable, so start over with a fresh one
+      close(fd);
+      fd = socket(AF_UNIX, SOCK_STREAM, 0);
+      if (fd < 0) {
+        throw std::runtime_error(std::string("Cannot create socket: ") + std::strerror(errno));
+      }
+    }
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0) {
+      int err = errno;
+      close(fd);
+      throw std::runtime_error("Cannot listen on " + path + ": " + std::strerror(err));
+    }
+    return fd;
+  }
+#endif
+}
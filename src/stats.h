@@ -0,0 +1,183 @@
+#pragma once
+
+// Run statistics for --stats / --stats-json
+// Phases are timed with PhaseTimer, which reads the clock only when a RunStats
+// is attached to the run, so the default path pays a null check. Building with
+// -DRAIN_NO_STATS removes the timers altogether.
+// Phase times are summed over worker threads, so with several workers they can
+// add up to more than the wall time. With mmap, page faults land in the hash phase.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+enum class Phase {
+  Read,
+  Hash,
+  Finalize,
+  Output,
+  Count
+};
+
+class RunStats {
+  public:
+    // kernels names the ISA the hashes ran with, for A/B runs
+    explicit RunStats(std::string kernels = "") : kernels(std::move(kernels)), start(std::chrono::steady_clock::now()) {
+      for (auto& ns : phase_ns) {
+        ns = 0;
+      }
+    }
+
+    void addTime(Phase phase, uint64_t ns) {
+      phase_ns[static_cast<int>(phase)] += ns;
+    }
+
+    void addBytes(uint64_t n) {
+      bytes += n;
+    }
+
+    // Wall time to digest one input
+    void addFile(uint64_t ns) {
+      files++;
+      std::lock_guard<std::mutex> lock(latency_mutex);
+      latencies.push_back(ns);
+    }
+
+    void report(std::ostream& out, bool json) {
+      double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      double cpu = cpuSeconds();
+      double gib = bytes / double(1 << 30);
+      double rate = gib / std::max(wall, 1e-9);
+      const char* names[] = {"read", "hash", "finalize", "output"};
+
+      std::sort(latencies.begin(), latencies.end());
+      double p50 = percentile(0.50), p90 = percentile(0.90), p99 = percentile(0.99);
+      double max = latencies.empty() ? 0 : latencies.back() / 1e6;
+
+      char line[256];
+      if (json) {
+        out << "{\"bytes\":" << bytes.load() << ",\"files\":" << files.load() << ",\"kernels\":\"" << kernels << "\"";
+        std::snprintf(line, sizeof(line), ",\"wall_s\":%.6f,\"cpu_s\":%.6f,\"gib_per_s\":%.4f", wall, cpu, rate);
+        out << line;
+        for (int i = 0; i < static_cast<int>(Phase::Count); i++) {
+          std::snprintf(line, sizeof(line), ",\"%s_s\":%.6f", names[i], phase_ns[i] / 1e9);
+          out << line;
+        }
+        std::snprintf(line, sizeof(line), ",\"latency_ms\":{\"p50\":%.4f,\"p90\":%.4f,\"p99\":%.4f,\"max\":%.4f}}\n", p50, p90, p99, max);
+        out << line;
+        return;
+      }
+
+      std::snprintf(line, sizeof(line), "rainsum: %llu bytes in %llu file(s), %.3f s wall, %.3f s cpu, %.3f GiB/s, %s kernels\n",
+                    (unsigned long long)bytes.load(), (unsigned long long)files.load(), wall, cpu, rate, kernels.c_str());
+      out << line;
+      out << "rainsum: time in";
+      for (int i = 0; i < static_cast<int>(Phase::Count); i++) {
+        std::snprintf(line, sizeof(line), " %s %.3f s%s", names[i], phase_ns[i] / 1e9, i + 1 < static_cast<int>(Phase::Count) ? "," : "\n");
+        out << line;
+      }
+      std::snprintf(line, sizeof(line), "rainsum: per-file latency p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, max %.3f ms\n", p50, p90, p99, max);
+      out << line;
+    }
+
+  private:
+    double percentile(double p) const {
+      if (latencies.empty()) {
+        return 0;
+      }
+      size_t index = std::min(latencies.size() - 1, static_cast<size_t>(p * latencies.size()));
+      return latencies[index] / 1e6;
+    }
+
+    static double cpuSeconds() {
+#ifndef _WIN32
+      struct rusage usage;
+      if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+      }
+#endif
+      return std::clock() / double(CLOCKS_PER_SEC);
+    }
+
+    std::string kernels;
+    std::chrono::steady_clock::time_point start;
+    std::atomic<uint64_t> phase_ns[static_cast<int>(Phase::Count)];
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> files{0};
+    std::mutex latency_mutex;
+    std::vector<uint64_t> latencies;
+};
+
+// Adds the time from construction to destruction to one phase of stats, if any
+class PhaseTimer {
+  public:
+#ifndef RAIN_NO_STATS
+    PhaseTimer(RunStats* stats, Phase phase) : stats(stats), phase(phase) {
+      if (stats) {
+        start = std::chrono::steady_clock::now();
+      }
+    }
+
+    ~PhaseTimer() {
+      if (stats) {
+        stats->addTime(phase, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+      }
+    }
+
+  private:
+    RunStats* stats;
+    Phase phase;
+    std::chrono::steady_clock::time_point start;
+#else
+    PhaseTimer(RunStats*, Phase) {}
+#endif
+
+  public:
+    PhaseTimer(const PhaseTimer&) = delete;
+    PhaseTimer& operator=(const PhaseTimer&) = delete;
+};
+
+// Records the time from construction to destruction as the latency of files
+// inputs, which were digested together
+class FileTimer {
+  public:
+#ifndef RAIN_NO_STATS
+    explicit FileTimer(RunStats* stats, uint64_t files = 1) : stats(stats), files(files) {
+      if (stats) {
+        start = std::chrono::steady_clock::now();
+      }
+    }
+
+    ~FileTimer() {
+      if (stats) {
+        uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        for (uint64_t i = 0; i < files; i++) {
+          stats->addFile(ns);
+        }
+      }
+    }
+
+  private:
+    RunStats* stats;
+    uint64_t files;
+    std::chrono::steady_clock::time_point start;
+#else
+    explicit FileTimer(RunStats*, uint64_t = 1) {}
+#endif
+
+  public:
+    FileTimer(const FileTimer&) = delete;
+    FileTimer& operator=(const FileTimer&) = delete;
+};
@@ -1,6 +1,23 @@
+#pragma once
+
+#include <array>
+#include <cerrno>
 #include <fstream>
+#include <iostream>
+#include <sstream>
+#include <unordered_map>
 #include <sys/stat.h>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <sys/vfs.h>
+#endif
+
 // only define USE_FILESYSTEM if it is supported and needed
 #ifdef USE_FILESYSTEM
 #include <filesystem>
@@ -11,18 +28,53 @@
 #include "rainstorm.cpp"
 #include "cxxopts.hpp"
 #include "common.h"
+#include "stats.h"
 
 #define VERSION "1.1.0"
 
+// stdin up to this size is hashed from memory, beyond it we spool to a temporary file
+constexpr size_t STDIN_BUFFER_LIMIT = 64 * CHUNK_SIZE;
+
+// the most files batch mode may hash ahead of the line it is waiting to print
+constexpr uint64_t BATCH_WINDOW = 65536;
+
+// files per batch task, one full set of multi-buffer lanes
+constexpr size_t BATCH_GROUP = 8;
+
+// walked files above this size get a batch task of their own rather than a
+// lane in a group, where the lanes beside them would sit idle
+constexpr uint64_t BATCH_LARGE_FILE = 1 << 20;
+
+// MappedFile reads files up to this size rather than mapping them
+constexpr uint64_t SMALL_FILE_READ = 64 << 10;
+
+// xof and keystream output is generated in pieces of this size, one per worker
+constexpr size_t SEEKABLE_SEGMENT = 1 << 20;
+
+// output is collected in memory and written out once this much has built up
+constexpr size_t OUTPUT_BUFFER_SIZE = 1 << 20;
+
+// read sizes for regular files: local disks default to DEFAULT_BLOCK_SIZE or
+// the filesystem's preferred size if larger, network filesystems to
+// NETWORK_BLOCK_SIZE, and --block-size must fall within MIN..MAX
+constexpr size_t DEFAULT_BLOCK_SIZE = 1 << 20;
+constexpr size_t NETWORK_BLOCK_SIZE = 4 << 20;
+constexpr size_t MIN_BLOCK_SIZE = 4096;
+constexpr size_t MAX_BLOCK_SIZE = 256 << 20;
+
 enum class Mode {
   Digest,
-  Stream
+  Stream,
+  Xof,
+  Keystream
 };
 
 std::string modeToString(const Mode& mode) {
     switch(mode) {
         case Mode::Digest: return "Digest";
         case Mode::Stream: return "Stream";
+        case Mode::Xof: return "Xof";
+        case Mode::Keystream: return "Keystream";
         default: throw std::runtime_error("Unknown hash mode (expected digest or stream)");
     }
 }
@@ -34,6 +86,10 @@ std::istream& operator>>(std::istream& in, Mode& mode) {
     mode = Mode::Digest;
   else if (token == "stream")
     mode = Mode::Stream;
+  else if (token == "xof")
+    mode = Mode::Xof;
+  else if (token == "keystream")
+    mode = Mode::Keystream;
   else
     in.setstate(std::ios_base::failbit);
   return in;
@@ -75,10 +131,93 @@ HashAlgorithm getHashAlgorithm(const std::string& algorithm) {
     }
 }
 
+// How digest mode writes each digest
+enum class DigestFormat {
+  Hex,                              // "<hex> <name>" lines
+  Base64,                           // "<base64> <name>" lines
+  Binary                            // bare digests back to back, no names
+};
+
+class WorkPool;
+
+// A digest of at most 512 bits, stored inline so that hashing a file
+// allocates nothing for it. Offers the parts of std::vector the digest
+// paths use.
+struct Digest {
+  std::array<uint8_t, 64> bytes{};
+  size_t length = 0;
+
+  Digest() = default;
+  explicit Digest(size_t len) {
+    resize(len);
+  }
+
+  void resize(size_t len) {
+    if (len > bytes.size()) {
+      throw std::runtime_error("Digests are at most 512 bits");
+    }
+    length = len;
+  }
+
+  uint8_t* data() { return bytes.data(); }
+  const uint8_t* data() const { return bytes.data(); }
+  size_t size() const { return length; }
+
+  bool operator==(const Digest& other) const {
+    return length == other.length && std::memcmp(bytes.data(), other.bytes.data(), length) == 0;
+  }
+  bool operator!=(const Digest& other) const {
+    return !(*this == other);
+  }
+};
+
+// How each input is hashed, shared by the single file, batch and check paths
+struct HashOptions {
+  HashAlgorithm algot = HashAlgorithm::Rainbow;
+  uint32_t size = 256;
+  uint64_t seed = 0;
+  bool use_mmap = true;
+  bool direct = false;              // O_DIRECT reads, implies no mmap
+  bool tree = false;
+  int rounds = rainstorm::ROUNDS;   // --rounds, Rainstorm only
+  size_t block_size = 0;            // --block-size, 0 picks one per file
+  size_t chunk_avg = 0;             // --chunks average chunk size, 0 when not chunking
+  std::string index;                // --index sidecar path, empty for none
+  std::vector<std::pair<uint64_t, uint64_t>> dirty;   // --dirty ranges, offset and length
+  DigestFormat format = DigestFormat::Hex;
+  uint64_t offset = 0;              // where xof and keystream output starts
+  WorkPool* pool = nullptr;         // runs tree leaves in parallel, null hashes them in turn
+  std::vector<unsigned> cpus;       // --cpu-list, CPUs to pin workers to, empty leaves them unpinned
+  RunStats* stats = nullptr;        // --stats timers, null when not collecting
+};
+
+// One file for batch mode, with the digest it should have when verifying a manifest
+struct BatchEntry {
+  std::string path;
+  std::string expected;
+  uint32_t size = 0;                // hash size for this entry, 0 for the run's size
+  int64_t  file_size = -1;          // known from a directory walk, else -1
+};
+
+struct BatchTotals {
+  uint64_t files = 0;
+  uint64_t bytes = 0;
+  uint64_t mismatched = 0;
+  uint64_t unreadable = 0;
+};
+
+bool validHashSize(HashAlgorithm algot, size_t size) {
+    switch(algot) {
+        case HashAlgorithm::Rainbow: return size == 64 || size == 128 || size == 256;
+        case HashAlgorithm::Rainstorm: return size == 64 || size == 128 || size == 256 || size == 512;
+        default: return false;
+    }
+}
+
 // Prototype of functions
 void usage();
-void hashBuffer(Mode mode, HashAlgorithm algot, std::vector<uint8_t>& buffer, uint64_t seed, uint64_t output_length, std::ostream& outstream, uint32_t hash_size);
-void hashAnything(Mode mode, HashAlgorithm algot , const std::string& inpath, const std::string& outpath, uint32_t size, bool use_test_vectors, uint64_t seed, uint64_t output_length);
+void hashBuffer(Mode mode, HashAlgorithm algot, const uint8_t* data, size_t len, uint64_t seed, uint64_t output_length, std::ostream& outstream, uint32_t hash_size, int rounds);
+void hashAnything(Mode mode, const HashOptions& opts, const std::string& inpath, std::ostream& outstream, bool use_test_vectors, uint64_t output_length);
 std::string generate_filename(const std::string& filename);
 uint64_t hash_string_to_64_bit(const std::string& seed_str);
 
@@ -90,6 +229,293 @@ uint64_t getFileSize(const std::string& filename) {
     return st.st_size;
 }
 
+bool isRegularFile(const std::string& filename) {
+    struct stat st;
+    return stat(filename.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+}
+
+// Byte count with an optional K, M or G suffix (powers of 1024)
+size_t parseByteCount(const std::string& text, const std::string& what) {
+    size_t end = 0;
+    uint64_t value = 0;
+    try {
+      value = std::stoull(text, &end);
+    } catch (const std::exception&) {
+      end = 0;
+    }
+    std::string suffix = text.substr(end);
+    unsigned shift = 0;
+    if (suffix == "K" || suffix == "k") {
+      shift = 10;
+    } else if (suffix == "M" || suffix == "m") {
+      shift = 20;
+    } else if (suffix == "G" || suffix == "g") {
+      shift = 30;
+    } else if (!suffix.empty() || end == 0) {
+      throw std::runtime_error("Invalid " + what + ": " + text);
+    }
+    // refuse rather than wrap, 17592186044420M must not come out as 4M
+    if (value > (UINT64_MAX >> shift) || (value << shift) > SIZE_MAX) {
+      throw std::runtime_error("Invalid " + what + ", too large: " + text);
+    }
+    return static_cast<size_t>(value << shift);
+}
+
+size_t parseBlockSize(const std::string& text) {
+    size_t value = parseByteCount(text, "block size");
+    if (value < MIN_BLOCK_SIZE || value > MAX_BLOCK_SIZE) {
+      throw std::runtime_error("Block size must be between " + std::to_string(MIN_BLOCK_SIZE) + " and " + std::to_string(MAX_BLOCK_SIZE) + " bytes: " + text);
+    }
+    return value;
+}
+
+// Filesystems where each read is a round trip to a server, so big reads pay off
+bool isNetworkFilesystem(const std::string& filename) {
+#ifdef __linux__
+    struct statfs fs;
+    if (statfs(filename.c_str(), &fs) != 0) {
+      return false;
+    }
+    switch (static_cast<uint32_t>(fs.f_type)) {
+      case 0x6969:        // NFS
+      case 0x00c36400:    // CephFS
+      case 0xff534d42:    // CIFS
+      case 0xfe534d42:    // SMB2
+      case 0x517b:        // SMB
+      case 0x01021997:    // 9P
+      case 0x0bd00bd0:    // Lustre
+      case 0x47504653:    // GPFS
+        return true;
+    }
+#else
+    (void)filename;
+#endif
+    return false;
+}
+
+// How much to read at a time from a regular file
+size_t ioBlockSize(const HashOptions& opts, const std::string& filename) {
+    if (opts.block_size) {
+      return opts.block_size;
+    }
+    if (isNetworkFilesystem(filename)) {
+      return NETWORK_BLOCK_SIZE;
+    }
+    size_t block_size = DEFAULT_BLOCK_SIZE;
+#ifndef _WIN32
+    struct stat st;
+    if (stat(filename.c_str(), &st) == 0 && st.st_blksize > 0) {
+      block_size = std::max(block_size, std::min<size_t>(st.st_blksize, MAX_BLOCK_SIZE));
+    }
+#endif
+    return block_size;
+}
+
+// Ask the kernel to start reading a file we will hash soon
+void prefetchFile(const std::string& filename) {
+#if !defined(_WIN32) && defined(POSIX_FADV_WILLNEED)
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd >= 0) {
+      posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+      close(fd);
+    }
+#else
+    (void)filename;
+#endif
+}
+
+#ifndef _WIN32
+// Read the first size bytes of fd into buffer, growing it if needed but never
+// shrinking it, so a reused buffer stops allocating. False if the file
+// turned out shorter.
+bool readWhole(int fd, size_t size, std::vector<uint8_t>& buffer) {
+  if (buffer.size() < size) {
+    buffer.resize(size);
+  }
+  size_t got = 0;
+  while (got < size) {
+    ssize_t n = pread(fd, buffer.data() + got, size - got, got);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    got += n;
+  }
+  return true;
+}
+#endif
+
+// Read-only mapping of a whole regular file. data stays null when the file
+// cannot be mapped (pipes, devices, empty files, no mmap), so callers fall back to read()
+// Files of at most SMALL_FILE_READ bytes are read into memory instead, which
+// costs fewer syscalls and page faults than a mapping: into scratch when the
+// caller passes a buffer to reuse, else into one of the MappedFile's own.
+struct MappedFile {
+  const uint8_t* data = nullptr;
+  size_t size = 0;
+
+#ifndef _WIN32
+  explicit MappedFile(const std::string& filename, std::vector<uint8_t>* scratch = nullptr) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+      if (static_cast<uint64_t>(st.st_size) <= SMALL_FILE_READ) {
+        std::vector<uint8_t>& buffer = scratch ? *scratch : copy;
+        // a file that shrank since fstat is left to the read() fallback
+        if (readWhole(fd, st.st_size, buffer)) {
+          data = buffer.data();
+          size = st.st_size;
+        }
+      } else {
+        void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr != MAP_FAILED) {
+          data = static_cast<const uint8_t*>(addr);
+          size = st.st_size;
+          mapped = true;
+          madvise(addr, size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+          madvise(addr, size, MADV_HUGEPAGE);
+#endif
+        }
+      }
+    }
+    close(fd);
+  }
+
+  ~MappedFile() {
+    if (mapped) {
+      munmap(const_cast<uint8_t*>(data), size);
+    }
+  }
+#else
+  explicit MappedFile(const std::string&, std::vector<uint8_t>* = nullptr) {}
+#endif
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  private:
+    bool mapped = false;
+    std::vector<uint8_t> copy;
+};
+
+// Lowercase hex, two table lookups per byte
+void appendHex(std::string& out, const uint8_t* data, size_t len) {
+    static const char digits[] = "0123456789abcdef";
+    size_t start = out.size();
+    out.resize(start + len * 2);
+    char* dst = &out[start];
+    for (size_t i = 0; i < len; i++) {
+      dst[2 * i] = digits[data[i] >> 4];
+      dst[2 * i + 1] = digits[data[i] & 15];
+    }
+}
+
+// Standard base64 (RFC 4648) with padding
+void appendBase64(std::string& out, const uint8_t* data, size_t len) {
+    static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t i = 0;
+    for (; i + 3 <= len; i += 3) {
+      uint32_t v = (data[i] << 16) | (data[i + 1] << 8) | data[i + 2];
+      out += digits[v >> 18];
+      out += digits[(v >> 12) & 63];
+      out += digits[(v >> 6) & 63];
+      out += digits[v & 63];
+    }
+    if (i < len) {
+      uint32_t v = data[i] << 16;
+      if (i + 1 < len) {
+        v |= data[i + 1] << 8;
+      }
+      out += digits[v >> 18];
+      out += digits[(v >> 12) & 63];
+      out += i + 1 < len ? digits[(v >> 6) & 63] : '=';
+      out += '=';
+    }
+}
+
+// One digest as it appears in the output, followed by " name\n" unless binary
+void appendDigest(std::string& out, DigestFormat format, const uint8_t* digest, size_t len, const std::string& name) {
+    switch(format) {
+        case DigestFormat::Binary:
+          out.append(reinterpret_cast<const char*>(digest), len);
+          return;
+        case DigestFormat::Base64:
+          appendBase64(out, digest, len);
+          break;
+        default:
+          appendHex(out, digest, len);
+    }
+    out += ' ';
+    out += name;
+    out += '\n';
+}
+
+// One --chunks record: offset, length and digest, then the input name. In
+// binary the offset and length are 64-bit little-endian ahead of the digest.
+void appendChunkRecord(std::string& out, DigestFormat format, uint64_t offset, uint64_t len, const uint8_t* digest, size_t digest_len, const std::string& name) {
+    if (format == DigestFormat::Binary) {
+      uint8_t header[16];
+      PUT_U64<bswap>(offset, header, 0);
+      PUT_U64<bswap>(len, header, 8);
+      out.append(reinterpret_cast<const char*>(header), sizeof(header));
+    } else {
+      out += std::to_string(offset);
+      out += ' ';
+      out += std::to_string(len);
+      out += ' ';
+    }
+    appendDigest(out, format, digest, digest_len, name);
+}
+
+// Collects output in one large buffer and hands it to the stream in bulk
+class OutputBuffer {
+  public:
+    explicit OutputBuffer(std::ostream& out) : out(out) {
+      pending.reserve(OUTPUT_BUFFER_SIZE);
+    }
+
+    ~OutputBuffer() {
+      flush();
+    }
+
+    OutputBuffer(const OutputBuffer&) = delete;
+    OutputBuffer& operator=(const OutputBuffer&) = delete;
+
+    // Append directly to the buffer, then call commit()
+    std::string& buffer() {
+      return pending;
+    }
+
+    void commit() {
+      if (pending.size() >= OUTPUT_BUFFER_SIZE) {
+        flush();
+      }
+    }
+
+    void write(const std::string& text) {
+      pending += text;
+      commit();
+    }
+
+    void flush() {
+      if (!pending.empty()) {
+        out.write(pending.data(), pending.size());
+        pending.clear();
+      }
+      out.flush();
+    }
+
+  private:
+    std::ostream& out;
+    std::string pending;
+};
+
 #ifdef USE_FILESYSTEM
 std::string generate_filename(const std::string& filename) {
   std::filesystem::path p{filename};
@@ -119,29 +545,93 @@ std::string generate_filename(const std::string& filename) {
 #endif
 
 uint64_t hash_string_to_64_bit(const std::string& seed_str) {
-    std::vector<char> buffer(seed_str.begin(), seed_str.end());
-    std::vector<uint8_t> hash_output(8);  // 64 bits = 8 bytes
-    rainstorm::rainstorm<64, bswap>(buffer.data(), buffer.size(), 0, hash_output.data());  // assuming bswap is defined elsewhere
+    uint8_t hash_output[8];  // 64 bits = 8 bytes
+    rainstorm::rainstorm<64, bswap>(seed_str.data(), seed_str.size(), 0, hash_output);
     uint64_t seed = 0;
-    std::memcpy(&seed, hash_output.data(), 8);
+    std::memcpy(&seed, hash_output, 8);
     return seed;
 }
 
+// A --seed value: a number is used as it is, anything else is hashed to 64 bits
+uint64_t parseSeed(const std::string& text) {
+    uint64_t seed;
+    if (!(std::istringstream(text) >> seed)) {
+        seed = hash_string_to_64_bit(text);
+    }
+    return seed;
+}
+
+// Named seeds for --seed-file, one "name value" line each, where the value is
+// read as by --seed. Blank lines and lines starting with # are skipped.
+std::unordered_map<std::string, uint64_t> loadSeedFile(const std::string& path) {
+    std::ifstream in(path);
+    if (!in.is_open()) {
+      throw std::runtime_error("Cannot open seed file: " + path);
+    }
+    std::unordered_map<std::string, uint64_t> seeds;
+    std::string line;
+    size_t line_number = 0;
+    while (std::getline(in, line)) {
+      line_number++;
+      size_t start = line.find_first_not_of(" \t");
+      if (start == std::string::npos || line[start] == '#') {
+        continue;
+      }
+      size_t name_end = line.find_first_of(" \t", start);
+      size_t value_start = name_end == std::string::npos ? std::string::npos : line.find_first_not_of(" \t", name_end);
+      if (value_start == std::string::npos) {
+        throw std::runtime_error(path + ":" + std::to_string(line_number) + ": expected a name and a seed");
+      }
+      size_t value_end = line.find_last_not_of(" \t\r");
+      seeds[line.substr(start, name_end - start)] = parseSeed(line.substr(value_start, value_end + 1 - value_start));
+    }
+    return seeds;
+}
+
 void usage() {
-  std::cout << "Usage: rainsum [OPTIONS] [INFILE]\n"
+  std::cout << "Usage: rainsum [OPTIONS] [INFILE...]\n"
             << "Calculate a Rainbow or Rainstorm hash.\n\n"
             << "Options:\n"
-            << "  -m, --mode [digest|stream]        Specifies the mode, where:\n"
-            << "                                    digest mode (the default) gives a fixed length hash in hex, or\n"
-            << "                                    stream mode gives a variable length binary feedback output\n"
+            << "  -m, --mode [digest|stream|xof|keystream]\n"
+            << "                                    Specifies the mode, where:\n"
+            << "                                    digest mode (the default) gives a fixed length hash in hex,\n"
+            << "                                    stream mode gives a variable length binary feedback output,\n"
+            << "                                    xof mode gives variable length output squeezed from Rainstorm, or\n"
+            << "                                    keystream mode gives seekable counter-mode Rainstorm output\n"
             << "  -a, --algorithm [bow|storm]       Specify the hash algorithm to use. Default: storm\n"
             << "  -s, --size [64-256|64-512]        Specify the bit size of the hash. Default: 256\n"
             << "  -o, --output-file FILE            Output file for the hash or stream\n"
             << "  -t, --test-vectors                Calculate the hash of the standard test vectors\n"
-            << "  -l, --output-length HASHES        Set the output length in hash iterations (stream only)\n"
+            << "  -l, --output-length HASHES        Set the output length in hash iterations (all but digest)\n"
+            << "  --offset BYTES                    Start xof or keystream output at this byte offset\n"
             << "  -v, --version                     Print out the version\n"
+            << "  --no-mmap                         Read files in chunks instead of memory-mapping them\n"
+            << "  --serve[=SOCKET]                  Answer binary hash requests on stdin/stdout, or on a Unix socket\n"
+            << "  --chunks[=AVG]                    Split the input into content-defined chunks (AVG bytes on average, default 8K)\n"
+            << "                                    and print offset, length and digest for each\n"
+            << "  --index FILE                      With --tree, keep leaf digests in FILE and only re-hash changed leaves\n"
+            << "  --dirty OFFSET+LENGTH,...         Byte ranges changed since the index was written\n"
+            << "  --block-size BYTES                Read files this much at a time, e.g. 4M. Default: tuned per filesystem\n"
+            << "  --direct                          Read files with O_DIRECT, so a scan does not fill the page cache\n"
+            << "  --files-from FILE                 Also hash the files listed in FILE, one per line (- for stdin)\n"
+            << "  -r, --recursive                   Hash every regular file under the DIR arguments\n"
+            << "  --merkle                          With -r, print one root digest per directory\n"
+            << "  -0, --null                        Entries in the --files-from list are NUL-separated\n"
+            << "  -j, --threads N                   Worker threads for several files or tree leaves. Default: all cores\n"
+            << "  --cpu-list LIST                   Pin worker threads to these CPUs, like 0-7,16-23. Default: unpinned\n"
+            << "  --tree                            Tree mode: hash 1 MiB leaves in parallel, then combine them\n"
+            << "  --isa [scalar|avx2|avx512|neon]   Hash kernels to run, overriding RAIN_ISA. Default: the best the CPU has\n"
+            << "  --rounds [2|4|6|8]                Rainstorm rounds per block, fewer is faster. Default: 4\n"
+            << "  -c, --check MANIFEST              Verify the files listed in MANIFEST (hash and path per line)\n"
+            << "  --fail-fast                       With --check, stop at the first file that fails\n"
+            << "  --base64                          Print digests in base64 instead of hex\n"
+            << "  --binary-output                   Write bare binary digests back to back, without names\n"
+            << "  --stats                           Print bytes, timings by phase and per-file latency to stderr\n"
+            << "  --stats-json                      Print the same statistics to stderr as one JSON object\n"
             << "  --seed                            Seed value (64-bit number or string). If string is used,\n"
-            << "                                    it is hashed with Rainstorm to a 64-bit number\n";
+            << "                                    it is hashed with Rainstorm to a 64-bit number, unless it names\n"
+            << "                                    a seed in --seed-file\n"
+            << "  --seed-file FILE                  Named seeds, one \"name value\" line each\n";
 }
 
 // test vectors
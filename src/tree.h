@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+
+#include "common.h"
+#include "pool.h"
+
+// Tree hashing mode
+// Inputs longer than one leaf are cut into LEAF_SIZE leaves, and each leaf is
+// hashed on its own into a chaining value. Leaves are hashed LEAF_GROUP at a
+// time, in parallel when given a pool, and on a pool pinned across NUMA nodes
+// each group runs on the node its input pages are on.
+// A single parent node then hashes the chaining values in order followed by
+// the 64-bit input length. Leaves and the parent use seeds that are offset by
+// distinct domain constants, keeping tree nodes apart from plain hashes.
+// Inputs of at most one leaf hash exactly as the plain function does.
+namespace raintree {
+  constexpr size_t   LEAF_SIZE      = 1 << 20;
+  constexpr uint64_t LEAF_DOMAIN    = UINT64_C(0x7261696e6c656166);   // "rainleaf"
+  constexpr uint64_t PARENT_DOMAIN  = UINT64_C(0x7261696e726f6f74);   // "rainroot"
+
+  typedef void (*hash_fn)(const void* in, const size_t len, const seed_t seed, void* out);
+  typedef void (*many_fn)(const void* const* in, const size_t* len, size_t n, const seed_t seed, void* const* out);
+
+  // leaves handed to one task, so multi-buffer kernels get a full set of lanes
+  constexpr size_t   LEAF_GROUP     = 8;
+
+  template <hash_fn hash>
+  static void each(const void* const* in, const size_t* len, size_t n, const seed_t seed, void* const* out) {
+    for (size_t i = 0; i < n; i++) {
+      hash(in[i], len[i], seed, out[i]);
+    }
+  }
+
+  static inline uint64_t leafCount(uint64_t len) {
+    return len <= LEAF_SIZE ? 1 : (len + LEAF_SIZE - 1) / LEAF_SIZE;
+  }
+
+  // Chaining values of n leaves
+  template <many_fn leaf_many>
+  static inline void leaves(const void* const* in, const size_t* len, size_t n, seed_t seed, void* const* cvs) {
+    leaf_many(in, len, n, seed ^ LEAF_DOMAIN, cvs);
+  }
+
+  // The parent node is the chaining values in leaf order, then the input length
+  static inline std::vector<uint8_t> parentNode(const uint8_t* cvs, size_t cvs_len, uint64_t total_len) {
+    std::vector<uint8_t> node(cvs_len + 8);
+    std::memcpy(node.data(), cvs, cvs_len);
+    PUT_U64<bswap>(total_len, node.data(), cvs_len);
+    return node;
+  }
+
+  template <hash_fn root_hash>
+  static inline void parent(const uint8_t* cvs, size_t cvs_len, uint64_t total_len, seed_t seed, void* out) {
+    std::vector<uint8_t> node = parentNode(cvs, cvs_len, total_len);
+    root_hash(node.data(), node.size(), seed ^ PARENT_DOMAIN, out);
+  }
+
+  template <many_fn leaf_many, size_t cv_size, hash_fn root_hash>
+  static void hash(const void* in, const size_t len, const seed_t seed, void* out, WorkPool* pool = nullptr) {
+    if (len <= LEAF_SIZE) {
+      root_hash(in, len, seed, out);
+      return;
+    }
+
+    const uint8_t* data = static_cast<const uint8_t*>(in);
+    uint64_t count = leafCount(len);
+    std::vector<uint8_t> cvs(count * cv_size);
+
+    TaskGroup tasks(pool);
+    for (uint64_t first = 0; first < count; first += LEAF_GROUP) {
+      auto group = [=, &cvs] {
+        const void* leaf_in[LEAF_GROUP];
+        size_t leaf_len[LEAF_GROUP];
+        void* leaf_cv[LEAF_GROUP];
+        size_t n = std::min<uint64_t>(LEAF_GROUP, count - first);
+        for (size_t i = 0; i < n; i++) {
+          size_t offset = (first + i) * LEAF_SIZE;
+          leaf_in[i] = data + offset;
+          leaf_len[i] = std::min(LEAF_SIZE, len - offset);
+          leaf_cv[i] = cvs.data() + (first + i) * cv_size;
+        }
+        leaves<leaf_many>(leaf_in, leaf_len, n, seed, leaf_cv);
+      };
+      // hash each group on the node holding its first page, wherever that was faulted in
+      tasks.run(group, pool && pool->nodes() > 1 ? rainnuma::pageNode(data + first * LEAF_SIZE) : -1);
+    }
+    tasks.wait();
+
+    parent<root_hash>(cvs.data(), cvs.size(), len, seed, out);
+  }
+}
+
+// Per-algorithm entry points, for whichever hashes were included before this header.
+// Chaining values are always the widest digest the algorithm has. Rainstorm
+// needs multibuffer.h too, its leaves go through the multi-buffer kernels.
+#ifdef __RAINBNOWVERSION__
+namespace rainbow {
+  constexpr size_t TREE_CV_SIZE = 32;
+
+  template <uint32_t hashsize, bool bswap>
+  static void rainbow_tree(const void* in, const size_t len, const seed_t seed, void* out, WorkPool* pool = nullptr) {
+    raintree::hash<raintree::each<rainbow<256, bswap>>, TREE_CV_SIZE, rainbow<hashsize, bswap>>(in, len, seed, out, pool);
+  }
+}
+#endif
+
+#ifdef __STORMVERSION__
+namespace rainstorm {
+  constexpr size_t TREE_CV_SIZE = 64;
+
+  template <uint32_t hashsize, bool bswap, int rounds = ROUNDS>
+  static void rainstorm_tree(const void* in, const size_t len, const seed_t seed, void* out, WorkPool* pool = nullptr) {
+    raintree::hash<rainstorm_many<512, bswap, rounds>, TREE_CV_SIZE, rainstorm<hashsize, bswap, rounds>>(in, len, seed, out, pool);
+  }
+}
+#endif
@@ -0,0 +1,167 @@
+#pragma once
+
+// Parallel directory walk for -r
+// Walker threads share a stack of directories still to be listed. Each one
+// takes a directory, pushes the subdirectories it finds back on the stack and
+// the regular files into a bounded queue, which the caller drains with next().
+// Once the queue is full the walkers wait, so a deep tree is never held in
+// memory ahead of the hashing. Symlinks are not followed and other special
+// files are skipped, like `find -type f`. Files come out in no fixed order.
+//
+// Needs <filesystem> (USE_FILESYSTEM).
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+constexpr unsigned WALK_THREADS = 8;          // at most this many walkers, directory listing is mostly syscalls
+constexpr size_t   WALK_QUEUE   = 4096;       // files found but not yet taken by next()
+
+class DirectoryWalker {
+  public:
+    DirectoryWalker(const std::string& root, unsigned threads) {
+      dirs.push_back(std::filesystem::path(root));
+      threads = std::max(1u, std::min(threads, WALK_THREADS));
+      for (unsigned i = 0; i < threads; i++) {
+        walkers.emplace_back([this] { run(); });
+      }
+    }
+
+    ~DirectoryWalker() {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+      }
+      dir_available.notify_all();
+      space_available.notify_all();
+      for (auto& walker : walkers) {
+        walker.join();
+      }
+    }
+
+    DirectoryWalker(const DirectoryWalker&) = delete;
+    DirectoryWalker& operator=(const DirectoryWalker&) = delete;
+
+    // The next file found, false once the whole tree has been listed
+    bool next(std::string& path, uint64_t& size) {
+      std::unique_lock<std::mutex> lock(mutex);
+      file_available.wait(lock, [this] { return !files.empty() || finished(); });
+      if (files.empty()) {
+        return false;
+      }
+      path = std::move(files.front().path);
+      size = files.front().size;
+      files.pop_front();
+      space_available.notify_one();
+      return true;
+    }
+
+    // Directories and entries that could not be read, already reported on stderr
+    uint64_t errors() const {
+      std::lock_guard<std::mutex> lock(mutex);
+      return failures;
+    }
+
+  private:
+    struct File {
+      std::string path;
+      uint64_t size;
+    };
+
+    bool finished() const {
+      return dirs.empty() && listing == 0;
+    }
+
+    void fail(const std::filesystem::path& path, const std::error_code& ec) {
+      std::lock_guard<std::mutex> lock(mutex);
+      std::cerr << "rainsum: " << path.string() << ": " << ec.message() << '\n';
+      failures++;
+    }
+
+    void add(std::string path, uint64_t size) {
+      std::unique_lock<std::mutex> lock(mutex);
+      space_available.wait(lock, [this] { return files.size() < WALK_QUEUE || stopping; });
+      files.push_back({std::move(path), size});
+      file_available.notify_one();
+    }
+
+    void list(const std::filesystem::path& dir) {
+      std::error_code ec;
+      std::filesystem::directory_iterator it(dir, ec), end;
+      if (ec) {
+        fail(dir, ec);
+        return;
+      }
+      for (; it != end && !stopping; it.increment(ec)) {
+        // the entry types come from readdir, so only regular files cost a stat (for their size)
+        const auto& entry = *it;
+        std::error_code entry_ec;
+        auto type = entry.symlink_status(entry_ec).type();
+        if (entry_ec) {
+          fail(entry.path(), entry_ec);
+        } else if (type == std::filesystem::file_type::directory) {
+          std::lock_guard<std::mutex> lock(mutex);
+          dirs.push_back(entry.path());
+          dir_available.notify_one();
+        } else if (type == std::filesystem::file_type::regular) {
+          uint64_t size = entry.file_size(entry_ec);
+          if (entry_ec) {
+            fail(entry.path(), entry_ec);
+          } else {
+            add(entry.path().string(), size);
+          }
+        }
+      }
+      if (ec) {
+        fail(dir, ec);
+      }
+    }
+
+    void run() {
+      while (true) {
+        std::filesystem::path dir;
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          dir_available.wait(lock, [this] { return !dirs.empty() || listing == 0 || stopping; });
+          if (dirs.empty() || stopping) {
+            dir_available.notify_all();
+            file_available.notify_all();
+            return;
+          }
+          // depth first keeps the stack, and the open directories, small
+          dir = std::move(dirs.back());
+          dirs.pop_back();
+          listing++;
+        }
+        list(dir);
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          listing--;
+          if (finished()) {
+            dir_available.notify_all();
+            file_available.notify_all();
+          }
+        }
+      }
+    }
+
+    mutable std::mutex mutex;
+    std::condition_variable dir_available;
+    std::condition_variable file_available;
+    std::condition_variable space_available;
+    std::vector<std::filesystem::path> dirs;
+    std::deque<File> files;
+    unsigned listing = 0;                     // walkers inside list()
+    uint64_t failures = 0;
+    std::atomic<bool> stopping{false};
+    std::vector<std::thread> walkers;
+};
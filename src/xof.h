@@ -0,0 +1,95 @@
+#pragma once
+
+// Rainstorm XOF: an extendable output squeezed from the 1024-bit state
+// A 1024-bit root state is built once from a key (normally the digest of the
+// input). Output is cut into XOF_SEGMENT-byte segments. Each segment starts from
+// the root with its index mixed in, then yields one 512-bit block per step by
+// running the round function and emitting the low half of the state folded
+// with the high half. The high half is never emitted directly.
+// Segments are independent, so any offset is reached by skipping at most one
+// segment's worth of steps, and segments can be generated in parallel.
+//
+// Include rainstorm.cpp before this header.
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+namespace rainstorm {
+  constexpr size_t   XOF_BLOCK      = 64;
+  constexpr size_t   XOF_SEGMENT    = 1 << 20;
+  constexpr uint64_t XOF_DOMAIN     = UINT64_C(0x7261696e2d786f66);   // "rain-xof"
+
+  struct Xof {
+    uint64_t root[16];
+
+    // Root state from a key of any length
+    static Xof keyed(const void* key, size_t key_len, const seed_t seed) {
+      Xof xof;
+      const uint8_t* data = static_cast<const uint8_t*>(key);
+      initState(xof.root, seed ^ XOF_DOMAIN, key_len);
+      while (key_len >= 64) {
+        absorb<bswap>(xof.root, data);
+        data += 64;
+        key_len -= 64;
+      }
+      closeState<512>(xof.root, data, key_len);
+      return xof;
+    }
+
+    // State at the start of segment
+    void segment(uint64_t index, uint64_t* h) const {
+      uint64_t temp[8] = {index, XOF_DOMAIN, 0, 0, 0, 0, 0, 0};
+      std::memcpy(h, root, sizeof(root));
+      for (int i = 0; i < FINAL_ROUNDS; i++) {
+        weakfunc(h, temp, i & 1);
+      }
+    }
+
+    // Advance one step, writing the next 64 output bytes to out
+    static inline void squeeze(uint64_t* h, uint64_t step, uint8_t* out) {
+      uint64_t temp[8] = {step, 0, 0, 0, 0, 0, 0, 0};
+      for (int i = 0; i < ROUNDS; i++) {
+        weakfunc(h, temp, i & 1);
+      }
+      for (int i = 0, j = 8; i < 8; i++, j++) {
+        PUT_U64<bswap>(h[i] - h[j], out, i * 8);
+      }
+    }
+
+    // Write len bytes of output starting at byte offset
+    void read(uint64_t offset, void* out, size_t len) const {
+      uint8_t* dst = static_cast<uint8_t*>(out);
+      uint64_t h[16];
+      uint8_t block[XOF_BLOCK];
+
+      while (len > 0) {
+        uint64_t index = offset / XOF_SEGMENT;
+        uint64_t step = (offset % XOF_SEGMENT) / XOF_BLOCK;
+        segment(index, h);
+        for (uint64_t s = 0; s < step; s++) {
+          squeeze(h, s, block);
+        }
+
+        // Whole blocks go straight to the output, partial ones through block
+        size_t within = offset % XOF_BLOCK;
+        for (; step < XOF_SEGMENT / XOF_BLOCK && len > 0; step++) {
+          if (within == 0 && len >= XOF_BLOCK) {
+            squeeze(h, step, dst);
+            dst += XOF_BLOCK;
+            offset += XOF_BLOCK;
+            len -= XOF_BLOCK;
+            continue;
+          }
+          squeeze(h, step, block);
+          size_t take = std::min(len, XOF_BLOCK - within);
+          std::memcpy(dst, block + within, take);
+          dst += take;
+          offset += take;
+          len -= take;
+          within = 0;
+        }
+      }
+    }
+  };
+}